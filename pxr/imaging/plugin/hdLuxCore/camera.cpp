@@ -23,6 +23,7 @@
 //
 
 #include "pxr/imaging/hdLuxCore/camera.h"
+#include "pxr/imaging/hdLuxCore/trace.h"
 #include "pxr/imaging/hdLuxCore/renderDelegate.h"
 
 using namespace std;
@@ -39,7 +40,7 @@ void HdLuxCoreCamera::Sync(HdSceneDelegate* sceneDelegate,
 	HdDirtyBits* dirtyBits)
 {
     
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     if (*dirtyBits & HdCamera::DirtyViewMatrix) {
         sceneDelegate->SampleTransform(GetId(), &_transform);
@@ -24,10 +24,12 @@
 #include "pxr/imaging/glf/glew.h"
 
 #include "pxr/imaging/hdLuxCore/instancer.h"
+#include "pxr/imaging/hdLuxCore/trace.h"
 #include "pxr/imaging/hdLuxCore/renderDelegate.h"
 
 #include "pxr/imaging/hdLuxCore/sampler.h"
 #include "pxr/imaging/hd/sceneDelegate.h"
+#include "pxr/imaging/hd/tokens.h"
 
 #include "pxr/base/gf/vec3f.h"
 #include "pxr/base/gf/vec4f.h"
@@ -37,6 +39,7 @@
 #include "pxr/base/tf/staticTokens.h"
 
 #include <iostream>
+#include <vector>
 using namespace std;
 
 PXR_NAMESPACE_OPEN_SCOPE
@@ -47,6 +50,7 @@ PXR_NAMESPACE_OPEN_SCOPE
 TF_DEFINE_PRIVATE_TOKENS(
     _tokens,
     (instanceTransform)
+    (instanceId)
 
     (rotate)
     (scale)
@@ -58,17 +62,12 @@ HdLuxCoreInstancer::HdLuxCoreInstancer(HdSceneDelegate* delegate,
                                      SdfPath const &parentId)
     : HdInstancer(delegate, id, parentId)
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 }
 
 HdLuxCoreInstancer::~HdLuxCoreInstancer()
 {
-    logit(BOOST_CURRENT_FUNCTION);
-
-    TF_FOR_ALL(it, _primvarMap) {
-        delete it->second;
-    }
-    _primvarMap.clear();
+    HDLUXCORE_TRACE_FUNCTION();
 }
 
 void
@@ -76,7 +75,7 @@ HdLuxCoreInstancer::_SyncPrimvars()
 {
     HD_TRACE_FUNCTION();
     HF_MALLOC_TAG_FUNCTION();
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_LOG_FUNCTION();
 
     HdChangeTracker &changeTracker = 
         GetDelegate()->GetRenderIndex().GetChangeTracker();
@@ -103,11 +102,7 @@ HdLuxCoreInstancer::_SyncPrimvars()
                 if (HdChangeTracker::IsPrimvarDirty(dirtyBits, id, pv.name)) {
                     VtValue value = GetDelegate()->Get(id, pv.name);
                     if (!value.IsEmpty()) {
-                        if (_primvarMap.count(pv.name) > 0) {
-                            delete _primvarMap[pv.name];
-                        }
-                        _primvarMap[pv.name] =
-                            new HdVtBufferSource(pv.name, value);
+                        _primvarMap[pv.name] = value;
                     }
                 }
             }
@@ -124,7 +119,7 @@ HdLuxCoreInstancer::ComputeInstanceTransforms(SdfPath const &prototypeId)
     HD_TRACE_FUNCTION();
     HF_MALLOC_TAG_FUNCTION();
 
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_LOG_FUNCTION();
 
     _SyncPrimvars();
 
@@ -144,14 +139,23 @@ HdLuxCoreInstancer::ComputeInstanceTransforms(SdfPath const &prototypeId)
         transforms[i] = instancerTransform;
     }
 
+    // Each primvar buffer below is type-checked once and sampled in bulk
+    // into a contiguous array; out-of-range indices sample an identity
+    // value so they leave the transform unchanged.
+    size_t const numInstances = instanceIndices.size();
+    int const* indices = instanceIndices.cdata();
+
     // "translate" holds a translation vector for each index.
     if (_primvarMap.count(_tokens->translate) > 0) {
-        HdLuxCoreBufferSampler sampler(*_primvarMap[_tokens->translate]);
-        for (size_t i = 0; i < instanceIndices.size(); ++i) {
-            GfVec3f translate;
-            if (sampler.Sample(instanceIndices[i], &translate)) {
+        HdLuxCoreTypedBufferSampler<GfVec3f>
+            sampler(_primvarMap[_tokens->translate]);
+        if (sampler.IsValid()) {
+            std::vector<GfVec3f> translates(numInstances);
+            sampler.SampleRange(indices, numInstances, translates.data(),
+                                GfVec3f(0.0f));
+            for (size_t i = 0; i < numInstances; ++i) {
                 GfMatrix4d translateMat(1);
-                translateMat.SetTranslate(GfVec3d(translate));
+                translateMat.SetTranslate(GfVec3d(translates[i]));
                 transforms[i] = translateMat * transforms[i];
             }
         }
@@ -159,10 +163,14 @@ HdLuxCoreInstancer::ComputeInstanceTransforms(SdfPath const &prototypeId)
 
     // "rotate" holds a quaternion in <real, i, j, k> format for each index.
     if (_primvarMap.count(_tokens->rotate) > 0) {
-        HdLuxCoreBufferSampler sampler(*_primvarMap[_tokens->rotate]);
-        for (size_t i = 0; i < instanceIndices.size(); ++i) {
-            GfVec4f quat;
-            if (sampler.Sample(instanceIndices[i], &quat)) {
+        HdLuxCoreTypedBufferSampler<GfVec4f>
+            sampler(_primvarMap[_tokens->rotate]);
+        if (sampler.IsValid()) {
+            std::vector<GfVec4f> quats(numInstances);
+            sampler.SampleRange(indices, numInstances, quats.data(),
+                                GfVec4f(1.0f, 0.0f, 0.0f, 0.0f));
+            for (size_t i = 0; i < numInstances; ++i) {
+                GfVec4f const& quat = quats[i];
                 GfMatrix4d rotateMat(1);
                 rotateMat.SetRotate(GfRotation(GfQuaternion(
                     quat[0], GfVec3d(quat[1], quat[2], quat[3]))));
@@ -173,12 +181,15 @@ HdLuxCoreInstancer::ComputeInstanceTransforms(SdfPath const &prototypeId)
 
     // "scale" holds an axis-aligned scale vector for each index.
     if (_primvarMap.count(_tokens->scale) > 0) {
-        HdLuxCoreBufferSampler sampler(*_primvarMap[_tokens->scale]);
-        for (size_t i = 0; i < instanceIndices.size(); ++i) {
-            GfVec3f scale;
-            if (sampler.Sample(instanceIndices[i], &scale)) {
+        HdLuxCoreTypedBufferSampler<GfVec3f>
+            sampler(_primvarMap[_tokens->scale]);
+        if (sampler.IsValid()) {
+            std::vector<GfVec3f> scales(numInstances);
+            sampler.SampleRange(indices, numInstances, scales.data(),
+                                GfVec3f(1.0f));
+            for (size_t i = 0; i < numInstances; ++i) {
                 GfMatrix4d scaleMat(1);
-                scaleMat.SetScale(GfVec3d(scale));
+                scaleMat.SetScale(GfVec3d(scales[i]));
                 transforms[i] = scaleMat * transforms[i];
             }
         }
@@ -186,11 +197,14 @@ HdLuxCoreInstancer::ComputeInstanceTransforms(SdfPath const &prototypeId)
 
     // "instanceTransform" holds a 4x4 transform matrix for each index.
     if (_primvarMap.count(_tokens->instanceTransform) > 0) {
-        HdLuxCoreBufferSampler sampler(*_primvarMap[_tokens->instanceTransform]);
-        for (size_t i = 0; i < instanceIndices.size(); ++i) {
-            GfMatrix4d instanceTransform;
-            if (sampler.Sample(instanceIndices[i], &instanceTransform)) {
-                transforms[i] = instanceTransform * transforms[i];
+        HdLuxCoreTypedBufferSampler<GfMatrix4d>
+            sampler(_primvarMap[_tokens->instanceTransform]);
+        if (sampler.IsValid()) {
+            std::vector<GfMatrix4d> instanceTransforms(numInstances);
+            sampler.SampleRange(indices, numInstances,
+                                instanceTransforms.data(), GfMatrix4d(1));
+            for (size_t i = 0; i < numInstances; ++i) {
+                transforms[i] = instanceTransforms[i] * transforms[i];
             }
         }
     }
@@ -224,5 +238,86 @@ HdLuxCoreInstancer::ComputeInstanceTransforms(SdfPath const &prototypeId)
     return final;
 }
 
+template<typename T>
+VtArray<T>
+HdLuxCoreInstancer::_ComputeInstancePrimvar(SdfPath const &prototypeId,
+                                            TfToken const &name,
+                                            T const &fallback,
+                                            bool *authored)
+{
+    _SyncPrimvars();
+
+    VtIntArray instanceIndices =
+        GetDelegate()->GetInstanceIndices(GetId(), prototypeId);
+
+    VtArray<T> values(instanceIndices.size(), fallback);
+    bool found = false;
+
+    auto it = _primvarMap.find(name);
+    if (it != _primvarMap.end()) {
+        // Hold a reference so the viewed array outlives the sampler.
+        VtValue value = it->second;
+        HdLuxCoreTypedBufferSampler<T> sampler(value);
+        if (sampler.IsValid()) {
+            sampler.SampleRange(instanceIndices.cdata(), instanceIndices.size(),
+                                values.data(), fallback);
+            found = true;
+        }
+    }
+
+    if (GetParentId().IsEmpty()) {
+        *authored = found;
+        return values;
+    }
+
+    HdInstancer *parentInstancer =
+        GetDelegate()->GetRenderIndex().GetInstancer(GetParentId());
+    if (!TF_VERIFY(parentInstancer)) {
+        *authored = found;
+        return values;
+    }
+
+    // Flatten in the same order as ComputeInstanceTransforms(); the
+    // innermost instancer that authors the primvar wins.
+    bool parentFound = false;
+    VtArray<T> parentValues =
+        static_cast<HdLuxCoreInstancer*>(parentInstancer)->
+            _ComputeInstancePrimvar<T>(GetId(), name, fallback, &parentFound);
+
+    VtArray<T> final(parentValues.size() * values.size());
+    for (size_t i = 0; i < parentValues.size(); ++i) {
+        for (size_t j = 0; j < values.size(); ++j) {
+            final[i * values.size() + j] = found ? values[j] : parentValues[i];
+        }
+    }
+
+    *authored = found || parentFound;
+    return final;
+}
+
+VtVec3fArray
+HdLuxCoreInstancer::ComputeInstanceColors(SdfPath const &prototypeId)
+{
+    HD_TRACE_FUNCTION();
+
+    bool authored = false;
+    VtVec3fArray colors = _ComputeInstancePrimvar<GfVec3f>(prototypeId,
+        HdTokens->displayColor, GfVec3f(1.0f), &authored);
+
+    return authored ? colors : VtVec3fArray();
+}
+
+VtIntArray
+HdLuxCoreInstancer::ComputeInstanceIds(SdfPath const &prototypeId)
+{
+    HD_TRACE_FUNCTION();
+
+    bool authored = false;
+    VtIntArray ids = _ComputeInstancePrimvar<int>(prototypeId,
+        _tokens->instanceId, 0, &authored);
+
+    return authored ? ids : VtIntArray();
+}
+
 PXR_NAMESPACE_CLOSE_SCOPE
 
@@ -27,7 +27,8 @@
 #include "pxr/pxr.h"
 
 #include "pxr/imaging/hd/instancer.h"
-#include "pxr/imaging/hd/vtBufferSource.h"
+#include "pxr/base/vt/types.h"
+#include "pxr/base/vt/value.h"
 
 #include "pxr/base/tf/hashmap.h"
 #include "pxr/base/tf/token.h"
@@ -39,11 +40,15 @@ PXR_NAMESPACE_OPEN_SCOPE
 /// \class HdLuxCoreInstancer
 ///
 /// HdLuxCore implements instancing by adding prototype geometry to the BVH
-/// multiple times within HdLuxCoreMesh::Sync(). The only instance-varying
-/// attribute that HdLuxCore supports is transform, so the natural
-/// accessor to instancer data is ComputeInstanceTransforms(),
-/// which returns a list of transforms to apply to the given prototype
-/// (one instance per transform).
+/// multiple times within HdLuxCoreMesh::Sync(). The main instance-varying
+/// attribute is transform, so the natural accessor to instancer data is
+/// ComputeInstanceTransforms(), which returns a list of transforms to apply
+/// to the given prototype (one instance per transform).
+///
+/// Per-instance "displayColor" and "instanceId" primvars are also exposed,
+/// through ComputeInstanceColors() and ComputeInstanceIds(), in the same
+/// flattened order as the transforms. They are forwarded to LuxCore as
+/// object ids so that all instances can share one material.
 ///
 /// Nested instancing can be handled by recursion, and by taking the
 /// cartesian product of the transform arrays at each nesting level, to
@@ -70,7 +75,34 @@ public:
     ///   \return One transform per instance, to apply when drawing.
     VtMatrix4dArray ComputeInstanceTransforms(SdfPath const &prototypeId);
 
+    /// Computes the per-instance "displayColor" primvar for the provided
+    /// prototype id, flattened in the same order as
+    /// ComputeInstanceTransforms(). Nested instancers inherit the color of
+    /// their parent instance unless they author their own.
+    ///   \param prototypeId The prototype to compute colors for.
+    ///   \return One color per instance, or an empty array if no instancer
+    ///           in the hierarchy authors the primvar.
+    VtVec3fArray ComputeInstanceColors(SdfPath const &prototypeId);
+
+    /// Computes the per-instance "instanceId" primvar for the provided
+    /// prototype id, flattened in the same order as
+    /// ComputeInstanceTransforms().
+    ///   \param prototypeId The prototype to compute ids for.
+    ///   \return One id per instance, or an empty array if no instancer
+    ///           in the hierarchy authors the primvar.
+    VtIntArray ComputeInstanceIds(SdfPath const &prototypeId);
+
 private:
+    // Samples the instance primvar \p name of type \p T for each instance
+    // of \p prototypeId, flattening nested instancers. Instances without an
+    // authored value receive \p fallback; \p authored is set to whether
+    // any level of the hierarchy provides the primvar.
+    template<typename T>
+    VtArray<T> _ComputeInstancePrimvar(SdfPath const &prototypeId,
+                                       TfToken const &name,
+                                       T const &fallback,
+                                       bool *authored);
+
     // Checks the change tracker to determine whether instance primvars are
     // dirty, and if so pulls them. Since primvars can only be pulled once,
     // and are cached, this function is not re-entrant. However, this function
@@ -87,8 +119,10 @@ private:
     // Map of the latest primvar data for this instancer, keyed by
     // primvar name. Primvar values are VtValue, an any-type; they are
     // interpreted at consumption time (here, in ComputeInstanceTransforms).
+    // The VtArrays they hold are copy-on-write and shared with the scene
+    // delegate, so caching them does not copy the primvar data.
     TfHashMap<TfToken,
-              HdVtBufferSource*,
+              VtValue,
               TfToken::HashFunctor> _primvarMap;
 };
 
@@ -1,39 +1,541 @@
 #include "pxr/imaging/hdLuxCore/light.h"
+#include "pxr/imaging/hdLuxCore/trace.h"
 #include "pxr/imaging/hdLuxCore/renderDelegate.h"
+#include "pxr/imaging/hdLuxCore/renderParam.h"
+
+#include "pxr/imaging/hd/tokens.h"
+#include "pxr/base/arch/fileSystem.h"
+#include "pxr/base/arch/hash.h"
+#include "pxr/base/gf/rotation.h"
+#include "pxr/base/gf/vec3i.h"
+#include "pxr/base/vt/types.h"
+#include "pxr/usd/sdf/assetPath.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
 
 using namespace std;
 
 PXR_NAMESPACE_OPEN_SCOPE
 
+// Number of segments used to tessellate disk and cylinder light shapes
+static const int AREA_LIGHT_SEGMENTS = 32;
+
+// Tessellate the emitting surface of an area light in light space. UsdLux
+// rect and disk lights emit along -Z, cylinder lights are aligned with X and
+// emit outwards; triangles are wound so their normals face the emission
+// direction.
+static void
+_BuildAreaLightShape(TfToken const& lightType, float width, float height,
+                     float radius, float length,
+                     VtVec3fArray *points, VtVec3iArray *triangles)
+{
+    if (lightType == HdPrimTypeTokens->rectLight) {
+        float const w = width * 0.5f;
+        float const h = height * 0.5f;
+        points->push_back(GfVec3f(-w, -h, 0.0f));
+        points->push_back(GfVec3f( w, -h, 0.0f));
+        points->push_back(GfVec3f( w,  h, 0.0f));
+        points->push_back(GfVec3f(-w,  h, 0.0f));
+        triangles->push_back(GfVec3i(0, 2, 1));
+        triangles->push_back(GfVec3i(0, 3, 2));
+    } else if (lightType == HdPrimTypeTokens->diskLight) {
+        points->push_back(GfVec3f(0.0f));
+        for (int i = 0; i < AREA_LIGHT_SEGMENTS; i++) {
+            float const phi = 2.0f * M_PI * i / AREA_LIGHT_SEGMENTS;
+            points->push_back(GfVec3f(radius * cos(phi), radius * sin(phi), 0.0f));
+        }
+        for (int i = 0; i < AREA_LIGHT_SEGMENTS; i++) {
+            triangles->push_back(GfVec3i(0, 1 + (i + 1) % AREA_LIGHT_SEGMENTS, 1 + i));
+        }
+    } else if (lightType == HdPrimTypeTokens->cylinderLight) {
+        float const l = length * 0.5f;
+        for (int i = 0; i < AREA_LIGHT_SEGMENTS; i++) {
+            float const phi = 2.0f * M_PI * i / AREA_LIGHT_SEGMENTS;
+            points->push_back(GfVec3f(-l, radius * cos(phi), radius * sin(phi)));
+            points->push_back(GfVec3f( l, radius * cos(phi), radius * sin(phi)));
+        }
+        for (int i = 0; i < AREA_LIGHT_SEGMENTS; i++) {
+            int const a = 2 * i;
+            int const b = 2 * ((i + 1) % AREA_LIGHT_SEGMENTS);
+            triangles->push_back(GfVec3i(a, a + 1, b + 1));
+            triangles->push_back(GfVec3i(a, b + 1, b));
+        }
+    }
+}
+
+// Return a hash of an image file's contents and modification time. Hashes
+// are memoized per path and modification time, so lookdev sessions that keep
+// reloading the same images only read each of them once.
+static uint64_t
+_GetImageContentHash(std::string const& path)
+{
+    static std::mutex memoMutex;
+    static std::map<std::string, std::pair<double, uint64_t>> memo;
+
+    double mtime = 0.0;
+    ArchGetModificationTime(path.c_str(), &mtime);
+
+    {
+        std::lock_guard<std::mutex> guard(memoMutex);
+        auto it = memo.find(path);
+        if (it != memo.end() && it->second.first == mtime) {
+            return it->second.second;
+        }
+    }
+
+    uint64_t hash = ArchHash64((char const*)&mtime, sizeof(mtime));
+    std::ifstream file(path, std::ios::binary);
+    std::vector<char> buffer(1 << 20);
+    while (file) {
+        file.read(buffer.data(), buffer.size());
+        hash = ArchHash64(buffer.data(), file.gcount(), hash);
+    }
+
+    std::lock_guard<std::mutex> guard(memoMutex);
+    memo[path] = std::make_pair(mtime, hash);
+    return hash;
+}
+
+void HdLuxCoreLight::_StartImportanceMapCacheLookup(HdRenderParam *renderParam,
+                                                    std::string const& cacheDirectory)
+{
+    // A previous lookup's result is stale. It is left to finish rather than
+    // waited for, and only joined in Finalize().
+    if (_importanceMapTask.valid()) {
+        _staleImportanceMapTasks.push_back(std::move(_importanceMapTask));
+    }
+    _staleImportanceMapTasks.erase(std::remove_if(
+        _staleImportanceMapTasks.begin(), _staleImportanceMapTasks.end(),
+        [](std::future<void> const& task) {
+            return task.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        }), _staleImportanceMapTasks.end());
+
+    _importanceMapDirectory = cacheDirectory;
+    _importanceMapPath.clear();
+
+    // The map is keyed on the texture alone: reusing it after geometry
+    // changes only affects sampling efficiency, not the converged image.
+    // Constant domes have no texture to key on and are not cached.
+    std::promise<std::string> promise;
+    _importanceMapFile = promise.get_future();
+    HdLuxCoreRenderParam *lc_renderParam = static_cast<HdLuxCoreRenderParam*>(renderParam);
+    _importanceMapTask = std::async(std::launch::async,
+        [lc_renderParam, cacheDirectory](std::string textureFile,
+                                         std::promise<std::string> result) {
+            std::string path;
+            if (!cacheDirectory.empty() && !textureFile.empty()) {
+                path = HdLuxCoreRenderParam::GetPersistentCacheFile(
+                    cacheDirectory, "vismap", _GetImageContentHash(textureFile));
+            }
+            bool const cached = !path.empty();
+            result.set_value(path);
+
+            // Have the render pass pick up the cache file
+            if (cached) {
+                lc_renderParam->MarkSceneDirty();
+            }
+        }, _textureFile, std::move(promise));
+}
+
 void HdLuxCoreLight::Sync(HdSceneDelegate* sceneDelegate, HdRenderParam* renderParam, HdDirtyBits* dirtyBits)
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
+
+    HdLuxCoreRenderStats::ScopedPhase phase(
+        &static_cast<HdLuxCoreRenderParam*>(renderParam)->GetStats(),
+        HdLuxCoreRenderStats::PhaseSync);
+    if (*dirtyBits & AllDirty) {
+        static_cast<HdLuxCoreRenderParam*>(renderParam)->GetStats().MarkEdit();
+    }
+
+    SdfPath const& id = GetId();
 
     if (*dirtyBits & HdLight::DirtyTransform)
     {
-        VtValue transform = sceneDelegate->Get(GetId(), HdLightTokens->transform);
+        VtValue transform = sceneDelegate->Get(id, HdLightTokens->transform);
         if (transform.IsHolding<GfMatrix4d>())
             _transform = transform.Get<GfMatrix4d>();
         else
             _transform = GfMatrix4d(1);
     }
 
+    // Everything but the emission, to detect edits that can be applied as a
+    // light group scale
+    auto const shapeParams = std::make_tuple(_normalize, _treatAsPoint, _radius,
+        _width, _height, _length, _angle, _textureFile);
+
     if (*dirtyBits & HdLight::DirtyParams)
     {
-        _color = sceneDelegate->GetLightParamValue(GetId(), HdPrimvarRoleTokens->color).Get<GfVec3f>();
-        _intensity = sceneDelegate->GetLightParamValue(GetId(), HdLightTokens->intensity).Get<float>();
-        _exposure = sceneDelegate->GetLightParamValue(GetId(), HdLightTokens->exposure).Get<float>();
-        _treatAsPoint = sceneDelegate->GetLightParamValue(GetId(), UsdLuxTokens->treatAsPoint).GetWithDefault(false);
+        _color = sceneDelegate->GetLightParamValue(id, HdPrimvarRoleTokens->color).GetWithDefault(GfVec3f(1.0f));
+        _intensity = sceneDelegate->GetLightParamValue(id, HdLightTokens->intensity).GetWithDefault(1.0f);
+        _exposure = sceneDelegate->GetLightParamValue(id, HdLightTokens->exposure).GetWithDefault(0.0f);
+        _normalize = sceneDelegate->GetLightParamValue(id, HdLightTokens->normalize).GetWithDefault(false);
+        _treatAsPoint = sceneDelegate->GetLightParamValue(id, UsdLuxTokens->treatAsPoint).GetWithDefault(false);
+
+        float const radius = sceneDelegate->GetLightParamValue(id, HdLightTokens->radius).GetWithDefault(0.5f);
+        float const width = sceneDelegate->GetLightParamValue(id, HdLightTokens->width).GetWithDefault(1.0f);
+        float const height = sceneDelegate->GetLightParamValue(id, HdLightTokens->height).GetWithDefault(1.0f);
+        float const length = sceneDelegate->GetLightParamValue(id, HdLightTokens->length).GetWithDefault(1.0f);
+        _shapeDirty = _shapeDirty || radius != _radius || width != _width ||
+            height != _height || length != _length;
+        _radius = radius;
+        _width = width;
+        _height = height;
+        _length = length;
+
+        _angle = sceneDelegate->GetLightParamValue(id, HdLightTokens->angle).GetWithDefault(0.53f);
+
+        std::string const previousTextureFile = _textureFile;
+        VtValue textureFile = sceneDelegate->GetLightParamValue(id, HdLightTokens->textureFile);
+        if (textureFile.IsHolding<SdfAssetPath>()) {
+            SdfAssetPath const& assetPath = textureFile.UncheckedGet<SdfAssetPath>();
+            _textureFile = assetPath.GetResolvedPath().empty() ?
+                assetPath.GetAssetPath() : assetPath.GetResolvedPath();
+        } else {
+            _textureFile.clear();
+        }
+
+        // LuxCore builds the visibility map of a dome light synchronously in
+        // the EndSceneEdit() that defines it, unless its persistent cache
+        // file exists. The file is named from the texture's content hash,
+        // which is computed off the Hydra thread, so later sessions load the
+        // map instead of building it again.
+        if (_lightType == HdPrimTypeTokens->domeLight) {
+            std::string const cacheDirectory =
+                sceneDelegate->GetRenderIndex().GetRenderDelegate()->GetRenderSetting<std::string>(
+                    HdLuxCoreRenderSettingsTokens->persistentCacheDirectory, std::string());
+            if (!_importanceMapTask.valid() || _textureFile != previousTextureFile ||
+                cacheDirectory != _importanceMapDirectory) {
+                _StartImportanceMapCacheLookup(renderParam, cacheDirectory);
+            }
+        }
+    }
+
+    bool const emissionOnly = !(*dirtyBits & HdLight::DirtyTransform) &&
+        shapeParams == std::make_tuple(_normalize, _treatAsPoint, _radius,
+            _width, _height, _length, _angle, _textureFile);
+
+    // Changes are written to LuxCore by the render pass, inside its scene
+    // edit, unless they only rescale the light's radiance group
+    if ((*dirtyBits & (HdLight::DirtyTransform | HdLight::DirtyParams)) &&
+        !(emissionOnly && _ApplyLightGroupScale(renderParam)))
+    {
+        _dirty = true;
+        static_cast<HdLuxCoreRenderParam*>(renderParam)->PauseRendering();
+        static_cast<HdLuxCoreRenderParam*>(renderParam)->MarkSceneDirty();
+    }
+
+    *dirtyBits = HdLight::Clean;
+}
+
+bool HdLuxCoreLight::IsAreaLight() const
+{
+    return _lightType == HdPrimTypeTokens->rectLight ||
+           _lightType == HdPrimTypeTokens->diskLight ||
+           _lightType == HdPrimTypeTokens->cylinderLight;
+}
+
+float HdLuxCoreLight::_GetArea() const
+{
+    if (_lightType == HdPrimTypeTokens->rectLight)
+        return _width * _height;
+    if (_lightType == HdPrimTypeTokens->diskLight)
+        return M_PI * _radius * _radius;
+    if (_lightType == HdPrimTypeTokens->cylinderLight)
+        return 2.0f * M_PI * _radius * _length;
+    if (_lightType == HdPrimTypeTokens->sphereLight)
+        return 4.0f * M_PI * _radius * _radius;
+
+    return 1.0f;
+}
+
+float HdLuxCoreLight::_GetGain(float area) const
+{
+    float gain = _intensity * pow(2.0f, _exposure);
+    if (_normalize && area > 0.0f)
+        gain /= area;
+
+    return gain;
+}
+
+GfVec3f HdLuxCoreLight::_GetEmission() const
+{
+    return _color * _GetGain(_GetArea());
+}
+
+bool HdLuxCoreLight::_ApplyLightGroupScale(HdRenderParam *renderParam)
+{
+    HdLuxCoreRenderParam *lc_renderParam = static_cast<HdLuxCoreRenderParam*>(renderParam);
+    if (!_created || _dirty || _lightGroup <= 0 ||
+        !lc_renderParam->GetLightGroupsEnabled()) {
+        return false;
     }
+
+    // The scale is relative to the emission the light was rendered with;
+    // a channel that was black can't be scaled up.
+    GfVec3f const emission = _GetEmission();
+    GfVec3f scale(1.0f);
+    for (int i = 0; i < 3; i++) {
+        if (_writtenEmission[i] != 0.0f) {
+            scale[i] = emission[i] / _writtenEmission[i];
+        } else if (emission[i] != 0.0f) {
+            return false;
+        }
+    }
+
+    lc_renderParam->SetLightGroupScale(_lightGroup, scale);
+    return true;
+}
+
+luxrays::Properties HdLuxCoreLight::_GetLightProperties() const
+{
+    std::string const prefix = "scene.lights." + GetId().GetString();
+    luxrays::Properties props;
+
+    if (_lightType == HdPrimTypeTokens->distantLight) {
+        // UsdLux distant lights emit along -Z; angle is the full angular
+        // diameter, LuxCore's theta is the half angle
+        GfVec3d const dir = _transform.TransformDir(GfVec3d(0.0, 0.0, -1.0)).GetNormalized();
+        float const gain = _GetGain(1.0f);
+        props <<
+            luxrays::Property(prefix + ".type")("distant") <<
+            luxrays::Property(prefix + ".direction")(dir[0], dir[1], dir[2]) <<
+            luxrays::Property(prefix + ".theta")(_angle * 0.5f) <<
+            luxrays::Property(prefix + ".color")(_color[0], _color[1], _color[2]) <<
+            luxrays::Property(prefix + ".gain")(gain, gain, gain);
+    } else if (_lightType == HdPrimTypeTokens->domeLight) {
+        // LuxCore environments are Z-up while UsdLux domes are Y-up
+        GfMatrix4d zUp(1.0);
+        zUp.SetRotate(GfRotation(GfVec3d(1.0, 0.0, 0.0), 90.0));
+        GfMatrix4f const m = GfMatrix4f(zUp * _transform);
+        float const *items = m.GetArray();
+
+        luxrays::Property transformation(prefix + ".transformation");
+        for (int i = 0; i < 16; i++) {
+            transformation.Add(items[i]);
+        }
+
+        // The visibility map drives importance sampling of the environment.
+        // It is loaded from or saved to the persistent cache file once
+        // _StartImportanceMapCacheLookup() has named it.
+        float const gain = _GetGain(1.0f);
+        if (!_textureFile.empty()) {
+            props <<
+                luxrays::Property(prefix + ".type")("infinite") <<
+                luxrays::Property(prefix + ".file")(_textureFile) <<
+                transformation;
+        } else {
+            props <<
+                luxrays::Property(prefix + ".type")("constantinfinite");
+        }
+        props <<
+            luxrays::Property(prefix + ".color")(_color[0], _color[1], _color[2]) <<
+            luxrays::Property(prefix + ".gain")(gain, gain, gain) <<
+            luxrays::Property(prefix + ".visibilitymapcache.enable")(true);
+        if (!_importanceMapPath.empty()) {
+            props << luxrays::Property(prefix + ".visibilitymapcache.persistent.file")(
+                _importanceMapPath);
+        }
+    } else {
+        // A LuxCore sphere light is a point light with a radius for soft
+        // shadows; its gain is a radiant intensity, which for a sphere of
+        // radiance L is L * pi * r^2
+        float const gain = _GetGain(_GetArea()) * M_PI * _radius * _radius;
+        props <<
+            luxrays::Property(prefix + ".type")(std::string(_treatAsPoint ? "point" : "sphere")) <<
+            luxrays::Property(prefix + ".position")(_transform[3][0], _transform[3][1], _transform[3][2]) <<
+            luxrays::Property(prefix + ".color")(_color[0], _color[1], _color[2]) <<
+            luxrays::Property(prefix + ".gain")(gain, gain, gain);
+        if (!_treatAsPoint) {
+            props << luxrays::Property(prefix + ".radius")(_radius);
+        }
+    }
+
+    // Emitted power is computed from the parameters above, not from LuxCore's
+    // power/efficiency normalization
+    props <<
+        luxrays::Property(prefix + ".power")(0.0f) <<
+        luxrays::Property(prefix + ".efficency")(0.0f) <<
+        luxrays::Property(prefix + ".id")(std::max(_lightGroup, 0));
+
+    return props;
+}
+
+luxrays::Properties HdLuxCoreLight::_UpdateAreaLight(luxcore::Scene *lc_scene)
+{
+    std::string const light_id = GetId().GetString();
+    std::string const shapeName = light_id + "_shape";
+    std::string const materialName = light_id + "_mtl";
+
+    if (_shapeDirty || !lc_scene->IsMeshDefined(shapeName)) {
+        VtVec3fArray points;
+        VtVec3iArray triangles;
+        _BuildAreaLightShape(_lightType, _width, _height, _radius, _length,
+                             &points, &triangles);
+
+        // LuxCore takes ownership of the buffers passed to DefineMesh()
+        float *verticies = (float *)luxcore::Scene::AllocVerticesBuffer(points.size());
+        memcpy(verticies, points.cdata(), points.size() * sizeof(GfVec3f));
+        unsigned int *triangle_indicies = (unsigned int *)luxcore::Scene::AllocTrianglesBuffer(triangles.size());
+        memcpy(triangle_indicies, triangles.cdata(), triangles.size() * sizeof(GfVec3i));
+
+        lc_scene->DefineMesh(shapeName, points.size(), triangles.size(), verticies, triangle_indicies, NULL, NULL, NULL, NULL);
+        _shapeDirty = false;
+    }
+
+    // A black, emissive material: emission is radiance, scaled by the gain
+    float const gain = _GetGain(_GetArea());
+    luxrays::Properties props;
+    props <<
+        luxrays::Property("scene.materials." + materialName + ".type")("matte") <<
+        luxrays::Property("scene.materials." + materialName + ".kd")(0.0f, 0.0f, 0.0f) <<
+        luxrays::Property("scene.materials." + materialName + ".emission")(_color[0], _color[1], _color[2]) <<
+        luxrays::Property("scene.materials." + materialName + ".emission.gain")(gain, gain, gain) <<
+        luxrays::Property("scene.materials." + materialName + ".emission.power")(0.0f) <<
+        luxrays::Property("scene.materials." + materialName + ".emission.efficency")(0.0f) <<
+        luxrays::Property("scene.materials." + materialName + ".emission.id")(std::max(_lightGroup, 0));
+
+    GfMatrix4f const m = GfMatrix4f(_transform);
+    float const *items = m.GetArray();
+    luxrays::Property transformation("scene.objects." + light_id + ".transformation");
+    for (int i = 0; i < 16; i++) {
+        transformation.Add(items[i]);
+    }
+
+    props <<
+        luxrays::Property("scene.objects." + light_id + ".shape")(shapeName) <<
+        luxrays::Property("scene.objects." + light_id + ".material")(materialName) <<
+        transformation;
+    lc_scene->Parse(props);
+
+    return props;
+}
+
+bool HdLuxCoreLight::UpdateLuxCoreLight(HdRenderParam* renderParam)
+{
+    // Attach the dome's visibility map cache file once it is named. This
+    // redefines the light, so LuxCore builds or loads the map again and the
+    // film restarts once.
+    if (_importanceMapFile.valid() &&
+        _importanceMapFile.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        _importanceMapPath = _importanceMapFile.get();
+        _dirty = _dirty || !_importanceMapPath.empty();
+    }
+
+    // Toggling light groups changes the light's radiance group
+    HdLuxCoreRenderParam *lc_renderParam = static_cast<HdLuxCoreRenderParam*>(renderParam);
+    if (lc_renderParam->GetLightGroupsEnabled()) {
+        if (_lightGroup < 0) {
+            _lightGroup = lc_renderParam->AcquireLightGroup(GetId().GetString());
+            _dirty = true;
+        }
+    } else if (_lightGroup >= 0) {
+        lc_renderParam->ReleaseLightGroup(GetId().GetString());
+        _lightGroup = -1;
+        _dirty = true;
+    }
+
+    // Lights are left out of the ambient occlusion preview and written
+    // again when it ends
+    if (lc_renderParam->GetPreviewMode()) {
+        if (!_created)
+            return false;
+
+        _DeleteLuxCoreLight(lc_renderParam);
+        _dirty = true;
+        return true;
+    }
+
+    if (!_dirty)
+        return false;
+
+    Scene *lc_scene = lc_renderParam->_scene;
+
+    // Parsing an existing light, material or object replaces its definition
+    // in place
+    uint64_t hash;
+    if (IsAreaLight()) {
+        float const shape[] = { _width, _height, _radius, _length };
+        hash = ArchHash64((char const*)shape, sizeof(shape));
+        hash = ArchHash64(_lightType.GetText(), _lightType.size(), hash);
+        std::string const props = _UpdateAreaLight(lc_scene).ToString();
+        hash = ArchHash64(props.c_str(), props.size(), hash);
+    } else {
+        luxrays::Properties const lightProps = _GetLightProperties();
+        lc_scene->Parse(lightProps);
+        std::string const props = lightProps.ToString();
+        hash = ArchHash64(props.c_str(), props.size());
+    }
+    lc_renderParam->SetContentHash(GetId().GetString(), hash);
+
+    // The light now emits its current color and intensity, so its radiance
+    // group is no longer scaled
+    _writtenEmission = _GetEmission();
+    if (_lightGroup > 0) {
+        lc_renderParam->SetLightGroupScale(_lightGroup, GfVec3f(1.0f));
+    }
+
+    _created = true;
+    _dirty = false;
+
+    return true;
 }
 
 void HdLuxCoreLight::Finalize(HdRenderParam* renderParam)
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
+
+    // Cache lookups notify the render param when done
+    if (_importanceMapTask.valid()) {
+        _importanceMapTask.wait();
+    }
+    for (std::future<void> const& task : _staleImportanceMapTasks) {
+        task.wait();
+    }
+    _staleImportanceMapTasks.clear();
+
+    HdLuxCoreRenderParam *lc_renderParam = static_cast<HdLuxCoreRenderParam*>(renderParam);
+    if (_lightGroup >= 0) {
+        lc_renderParam->ReleaseLightGroup(GetId().GetString());
+        _lightGroup = -1;
+    }
+
+    if (!_created)
+        return;
+
+    lc_renderParam->BeginSceneEdit();
+    _DeleteLuxCoreLight(lc_renderParam);
+    lc_renderParam->EndSceneEdit();
+
+    // Let the render pass restore the default light if this was the last one
+    lc_renderParam->MarkSceneDirty();
+}
+
+void HdLuxCoreLight::_DeleteLuxCoreLight(HdLuxCoreRenderParam *renderParam)
+{
+    Scene *lc_scene = renderParam->_scene;
+
+    if (IsAreaLight()) {
+        lc_scene->DeleteObject(GetId().GetString());
+        lc_scene->RemoveUnusedMeshes();
+        lc_scene->RemoveUnusedMaterials();
+    } else {
+        lc_scene->DeleteLight(GetId().GetString());
+    }
+
+    renderParam->RemoveContentHash(GetId().GetString());
+    _created = false;
 }
 
 HdDirtyBits HdLuxCoreLight::GetInitialDirtyBitsMask() const {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     return DirtyBits::DirtyTransform
          | DirtyBits::DirtyParams;
@@ -8,13 +8,35 @@
 #include "pxr/pxr.h"
 #include "pxr/base/gf/matrix4d.h"
 
+#include <luxcore/luxcore.h>
+
+#include <future>
+#include <string>
+#include <vector>
+
 PXR_NAMESPACE_OPEN_SCOPE
 
+class HdLuxCoreRenderParam;
+
+/// \class HdLuxCoreLight
+///
+/// Translates the UsdLux light types into LuxCore lights:
+///   - sphereLight: a LuxCore "sphere" light, or "point" if treatAsPoint
+///   - distantLight: a LuxCore "distant" light
+///   - rectLight, diskLight, cylinderLight: an emissive mesh object, since
+///     LuxCore has no analytic area lights
+///   - domeLight: an "infinite" light for a texture, "constantinfinite"
+///     otherwise, both with a visibility map for importance sampling
+///
+/// Emitted radiance follows UsdLux: color * intensity * 2^exposure, divided
+/// by the emitting area when "normalize" is set.
+///
 class HdLuxCoreLight : public HdLight {
     public:
         HdLuxCoreLight(SdfPath const& id, TfToken const& lightType)
             : HdLight(id), _lightType(lightType) {
                 _created = false;
+                _dirty = false;
             }
 
         ~HdLuxCoreLight() override = default;
@@ -59,14 +81,96 @@ class HdLuxCoreLight : public HdLight {
             return _treatAsPoint;
         }
 
+        /// Return true if the light changed since it was last written to
+        /// the LuxCore scene.
+        virtual bool IsDirty() const {
+            return _dirty;
+        }
+
+        /// Create or update the LuxCore light in place if it changed since
+        /// the last call. Must be called between BeginSceneEdit() and
+        /// EndSceneEdit().
+        ///   \param renderParam An HdLuxCoreRenderParam object
+        ///   \return True if the LuxCore scene was edited.
+        bool UpdateLuxCoreLight(HdRenderParam *renderParam);
+
+        /// Return true if this light is translated to an emissive mesh
+        /// object rather than a LuxCore light.
+        bool IsAreaLight() const;
+
     private:
+        // Return the UsdLux scalar gain, intensity * 2^exposure, optionally
+        // normalized by \p area.
+        float _GetGain(float area) const;
+
+        // Return the surface area of the emitting geometry.
+        float _GetArea() const;
+
+        // Return the emitted radiance, up to a factor that only depends on
+        // the light's shape.
+        GfVec3f _GetEmission() const;
+
+        // Apply an edit of the light's color or intensity as a scale of its
+        // radiance group. Returns false if the light has no group of its
+        // own, or the edit can't be expressed as a scale.
+        bool _ApplyLightGroupScale(HdRenderParam *renderParam);
+
+        // Delete the light's LuxCore light, or the object, shape and
+        // material of an area light. Must be called between
+        // BeginSceneEdit() and EndSceneEdit().
+        void _DeleteLuxCoreLight(HdLuxCoreRenderParam *renderParam);
+
+        // Build the light's LuxCore properties, for non-area lights.
+        luxrays::Properties _GetLightProperties() const;
+
+        // Define the emissive shape, material and object of an area light.
+        // Returns the material and object properties that were parsed.
+        luxrays::Properties _UpdateAreaLight(luxcore::Scene *lc_scene);
+
         GfMatrix4d _transform;
         float _intensity = 1.0;
-	float _exposure = 1.0;
+	float _exposure = 0.0;
         GfVec3f _color = GfVec3f(1.0f);
+        bool _normalize = false;
+
+        // Shape parameters, following the UsdLux schema defaults
+        float _radius = 0.5f;
+        float _width = 1.0f;
+        float _height = 1.0f;
+        float _length = 1.0f;
+        float _angle = 0.53f;
+        std::string _textureFile;
+
+        // Set when shape parameters change, so the area light mesh is only
+        // redefined when its geometry changed.
+        bool _shapeDirty = true;
+
+        // Start naming the persistent visibility map cache file of a dome
+        // light from its texture's content hash. Only the hash runs on a
+        // background thread: LuxCore builds the map itself, synchronously in
+        // EndSceneEdit(), whenever the file doesn't exist yet.
+        void _StartImportanceMapCacheLookup(HdRenderParam *renderParam,
+                                            std::string const& cacheDirectory);
+
+        // Dome light importance map state. _importanceMapTask runs the
+        // background lookup and _importanceMapFile receives the persistent
+        // cache file, empty if caching is disabled. Superseded lookups are
+        // kept in _staleImportanceMapTasks until they finish.
+        std::future<void> _importanceMapTask;
+        std::vector<std::future<void>> _staleImportanceMapTasks;
+        std::future<std::string> _importanceMapFile;
+        std::string _importanceMapDirectory;
+        std::string _importanceMapPath;
+
+        // The light's radiance group, -1 if light groups are disabled, and
+        // the emission it was last written to LuxCore with.
+        int _lightGroup = -1;
+        GfVec3f _writtenEmission = GfVec3f(0.0f);
+
         const TfToken _lightType;
         bool _created;
-        bool _treatAsPoint;
+        bool _dirty;
+        bool _treatAsPoint = false;
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
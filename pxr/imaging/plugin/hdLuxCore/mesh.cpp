@@ -23,6 +23,7 @@
 //
 #include "pxr/imaging/glf/glew.h"
 #include "pxr/imaging/hdLuxCore/mesh.h"
+#include "pxr/imaging/hdLuxCore/trace.h"
 #include "pxr/imaging/hd/renderPassState.h"
 #include "pxr/imaging/hdLuxCore/renderDelegate.h"
 #include "pxr/imaging/hdLuxCore/renderPass.h"
@@ -43,13 +44,17 @@
 #include "pxr/imaging/hdx/compositor.h"
 
 #include "pxr/base/gf/matrix4d.h"
+#include "pxr/base/gf/math.h"
+#include "pxr/base/gf/range3d.h"
+#include "pxr/base/arch/hash.h"
 #include "pxr/usd/sdf/identity.h"
 
 
-#if defined(_OPENMP)
-	#include <omp.h>
-	#include <opensubdiv/osd/ompEvaluator.h>
-	#define OSD_EVALUATOR Osd::OmpEvaluator
+// Evaluate stencils on the TBB scheduler shared with Hydra, rather than an
+// OpenMP pool that would oversubscribe the cores
+#if defined(OPENSUBDIV_HAS_TBB)
+	#include <opensubdiv/osd/tbbEvaluator.h>
+	#define OSD_EVALUATOR Osd::TbbEvaluator
 #else
 	#include <opensubdiv/osd/cpuEvaluator.h>
 	#define OSD_EVALUATOR Osd::CpuEvaluator
@@ -70,6 +75,7 @@
 #include <luxrays/utils/utils.h>
 
 #include <algorithm> // sort
+#include <cmath>
 
 PXR_NAMESPACE_OPEN_SCOPE
 
@@ -92,23 +98,28 @@ HdLuxCoreMesh::HdLuxCoreMesh(SdfPath const& id,
 void
 HdLuxCoreMesh::Finalize(HdRenderParam *renderParam)
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
-    Scene *lc_scene = reinterpret_cast<HdLuxCoreRenderParam*>(renderParam)->_scene;
-    RenderSession *lc_session = reinterpret_cast<HdLuxCoreRenderParam*>(renderParam)->_session;
+    HdLuxCoreRenderParam *lc_renderParam = reinterpret_cast<HdLuxCoreRenderParam*>(renderParam);
+    Scene *lc_scene = lc_renderParam->_scene;
     SdfPath const& id = GetId();
 
-    lc_session->BeginSceneEdit();
+    lc_renderParam->BeginSceneEdit();
+    for (int i = 0; i < _instances_rendered; i++) {
+        lc_scene->DeleteObject(GetInstanceName(i));
+    }
+    _instances_rendered = 0;
+    lc_renderParam->RemoveContentHash(id.GetString());
     if (lc_scene->IsMeshDefined(id.GetString())) {
-        lc_scene->DeleteObject(id.GetString());
+        lc_scene->RemoveUnusedMeshes();
     }
-    lc_session->EndSceneEdit();
+    lc_renderParam->EndSceneEdit();
 }
 
 HdDirtyBits
 HdLuxCoreMesh::GetInitialDirtyBitsMask() const
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     // The initial dirty bits control what data is available on the first
     // run through _PopulateRtMesh(), so it should list every data item
@@ -134,7 +145,7 @@ HdLuxCoreMesh::GetInitialDirtyBitsMask() const
 HdDirtyBits
 HdLuxCoreMesh::_PropagateDirtyBits(HdDirtyBits bits) const
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     return bits;
 }
@@ -145,7 +156,7 @@ HdLuxCoreMesh::_InitRepr(TfToken const &reprToken,
 {
     TF_UNUSED(dirtyBits);
 
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     // Create an empty repr.
     _ReprVector::iterator it = std::find_if(_reprs.begin(), _reprs.end(),
@@ -164,7 +175,18 @@ HdLuxCoreMesh::Sync(HdSceneDelegate *sceneDelegate,
     HD_TRACE_FUNCTION();
     HF_MALLOC_TAG_FUNCTION();
 
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_LOG_FUNCTION();
+
+    HdLuxCoreRenderStats::ScopedPhase phase(
+        &static_cast<HdLuxCoreRenderParam*>(renderParam)->GetStats(),
+        HdLuxCoreRenderStats::PhaseSync);
+
+    // Give the cores to sync and OpenSubdiv refinement; the render pass
+    // resumes rendering once the edits are in the scene
+    if (*dirtyBits & ~HdChangeTracker::Clean) {
+        static_cast<HdLuxCoreRenderParam*>(renderParam)->GetStats().MarkEdit();
+        static_cast<HdLuxCoreRenderParam*>(renderParam)->PauseRendering();
+    }
 
     // XXX: A mesh repr can have multiple repr decs; this is done, for example,
     // when the drawstyle specifies different rasterizing modes between front
@@ -193,6 +215,41 @@ HdLuxCoreMesh::Sync(HdSceneDelegate *sceneDelegate,
 			GfMatrix4d *transform = new GfMatrix4d(sceneDelegate->GetTransform(GetId()));
 			_transforms.push_back(transform);
 		}
+		_objects_dirty = true;
+	}
+
+	// Per-instance primvars are pulled in the same flattened order as the
+	// instance transforms.
+	if (!GetInstancerId().IsEmpty() &&
+		(*dirtyBits & (HdChangeTracker::DirtyTransform |
+					   HdChangeTracker::DirtyPrimvar |
+					   HdChangeTracker::DirtyInstanceIndex))) {
+		HdLuxCoreInstancer *luxInstancer = static_cast<HdLuxCoreInstancer*>(instancer);
+		_instanceColors = luxInstancer->ComputeInstanceColors(GetId());
+		_instanceIds = luxInstancer->ComputeInstanceIds(GetId());
+		_objects_dirty = true;
+	}
+
+	// The mesh's own displayColor, averaged to a single color for preview
+	// shading with scene colors
+	if (*dirtyBits & HdChangeTracker::DirtyPrimvar) {
+		VtValue color = sceneDelegate->Get(GetId(), HdTokens->displayColor);
+		_hasDisplayColor = false;
+		if (color.IsHolding<VtVec3fArray>()) {
+			VtVec3fArray const& colors = color.UncheckedGet<VtVec3fArray>();
+			if (!colors.empty()) {
+				GfVec3f sum(0.0f);
+				for (GfVec3f const& c : colors) {
+					sum += c;
+				}
+				_displayColor = sum / float(colors.size());
+				_hasDisplayColor = true;
+			}
+		} else if (color.IsHolding<GfVec3f>()) {
+			_displayColor = color.UncheckedGet<GfVec3f>();
+			_hasDisplayColor = true;
+		}
+		_objects_dirty = true;
 	}
 
 	// Get the mesh complexity level for OpenSubdiv
@@ -207,13 +264,20 @@ HdLuxCoreMesh::Sync(HdSceneDelegate *sceneDelegate,
 		_visible = sceneDelegate->GetVisible(GetId());
 	}
 
+	// Changes are written to LuxCore by the render pass, inside its scene edit
+	if (*dirtyBits & ~HdChangeTracker::Clean) {
+		static_cast<HdLuxCoreRenderParam*>(renderParam)->MarkSceneDirty();
+	}
+
 	*dirtyBits = HdChangeTracker::Clean;
 }
 
 // The following block is adapted from the LuxCore rendering system
-template <unsigned int DIMENSIONS> static Osd::CpuVertexBuffer *BuildBuffer(
+template <unsigned int DIMENSIONS> Osd::CpuVertexBuffer *HdLuxCoreBuildBuffer(
 	const Far::StencilTable *stencilTable, const float *data,
 	const unsigned int count, const unsigned int totalCount) {
+	TRACE_FUNCTION();
+
 	Osd::CpuVertexBuffer *buffer = Osd::CpuVertexBuffer::Create(DIMENSIONS, totalCount);
 
 	Osd::BufferDescriptor desc(0, DIMENSIONS, DIMENSIONS);
@@ -231,200 +295,281 @@ template <unsigned int DIMENSIONS> static Osd::CpuVertexBuffer *BuildBuffer(
 	return buffer;
 }
 
-bool
-HdLuxCoreMesh::CreateLuxCoreTriangleMesh(HdRenderParam* renderParam)
-{
-    logit(BOOST_CURRENT_FUNCTION);
+template Osd::CpuVertexBuffer *HdLuxCoreBuildBuffer<3>(
+	const Far::StencilTable *stencilTable, const float *data,
+	const unsigned int count, const unsigned int totalCount);
 
-    Scene *lc_scene = reinterpret_cast<HdLuxCoreRenderParam*>(renderParam)->_scene;
+std::vector<int>
+HdLuxCoreFindBoundaryVertices(VtVec3iArray const& triangles,
+                              size_t vertexCount)
+{
+	TRACE_SCOPE("HdLuxCoreMesh boundary edge detection");
+	unordered_map<Edge, unsigned int, EdgeHashFunction> edgesMap;
+	const unsigned int triCount = triangles.size();
+	const Triangle *tris = (const Triangle *)triangles.cdata();
+
+	// Count how many times an edge is shared
+	for (unsigned int i = 0; i < triCount; ++i) {
+		const Triangle &tri = tris[i];
+
+		const Edge edge0(tri.v[0], tri.v[1]);
+		if (edgesMap.find(edge0) != edgesMap.end())
+			edgesMap[edge0] += 1;
+		else
+			edgesMap[edge0] = 1;
+
+		const Edge edge1(tri.v[1], tri.v[2]);
+		if (edgesMap.find(edge1) != edgesMap.end())
+			edgesMap[edge1] += 1;
+		else
+			edgesMap[edge1] = 1;
+
+		const Edge edge2(tri.v[2], tri.v[0]);
+		if (edgesMap.find(edge2) != edgesMap.end())
+			edgesMap[edge2] += 1;
+		else
+			edgesMap[edge2] = 1;
+	}
 
-    // Used to name the type of mesh in LuxCore
-    SdfPath const& id = GetId();
+	vector<bool> isBoundaryVertex(vertexCount, false);
+	std::vector<int> boundaryVertices;
+	for (auto em : edgesMap) {
+		if (em.second == 1) {
+			// It is a boundary edge
 
-    if (lc_scene->IsMeshDefined(id.GetString())) {
-        return false;
-    }
+			const Edge &e = em.first;
 
-    // Triangulate the input faces.
-    HdMeshUtil meshUtil(&_topology, GetId());
-    meshUtil.ComputeTriangleIndices(&_triangulatedIndices,
-        &_trianglePrimitiveParams);
+			if (!isBoundaryVertex[e.vIndex[0]]) {
+				boundaryVertices.push_back(e.vIndex[0]);
+				isBoundaryVertex[e.vIndex[0]] = true;
+			}
 
-	// TODO: See if we can use the mesh type
-	if (id.GetString().rfind("/sphere", 0) == 0 && _refineLevel > 0) {
-
-		// The following OpenSubdiv code is adapted from the LuxCore rendering system
-
-		// -- BEGIN OPEN SUBDIBV -- //
-
-		Sdc::Options options;
-		options.SetVtxBoundaryInterpolation(Sdc::Options::VTX_BOUNDARY_EDGE_AND_CORNER);
-
-		Far::TopologyDescriptor desc;
-		desc.numVertices = _points.size();
-		desc.numFaces = _triangulatedIndices.size();
-		vector<int> vertPerFace(desc.numFaces, 3);
-		desc.numVertsPerFace = &vertPerFace[0];
-		desc.vertIndicesPerFace = (const int *)_triangulatedIndices.cdata();
-
-		// Look for mesh boundary edges
-		unordered_map<Edge, unsigned int, EdgeHashFunction> edgesMap;
-		const unsigned int triCount = _triangulatedIndices.size();
-		const Triangle *tris = (const Triangle *)_triangulatedIndices.cdata();;
-
-		// Count how many times an edge is shared
-		for (unsigned int i = 0; i < triCount; ++i) {
-			const Triangle &tri = tris[i];
-
-			const Edge edge0(tri.v[0], tri.v[1]);
-			if (edgesMap.find(edge0) != edgesMap.end())
-				edgesMap[edge0] += 1;
-			else
-				edgesMap[edge0] = 1;
-
-			const Edge edge1(tri.v[1], tri.v[2]);
-			if (edgesMap.find(edge1) != edgesMap.end())
-				edgesMap[edge1] += 1;
-			else
-				edgesMap[edge1] = 1;
-
-			const Edge edge2(tri.v[2], tri.v[0]);
-			if (edgesMap.find(edge2) != edgesMap.end())
-				edgesMap[edge2] += 1;
-			else
-				edgesMap[edge2] = 1;
+			if (!isBoundaryVertex[e.vIndex[1]]) {
+				boundaryVertices.push_back(e.vIndex[1]);
+				isBoundaryVertex[e.vIndex[1]] = true;
+			}
 		}
+	}
 
-		vector<bool> isBoundaryVertex(desc.numVertices, false);
-		vector<Far::Index> cornerVertexIndices;
-		vector<float> cornerWeights;
-		for (auto em : edgesMap) {
-			if (em.second == 1) {
-				// It is a boundary edge
+	return boundaryVertices;
+}
 
-				const Edge &e = em.first;
+void
+HdLuxCorePackMesh(VtVec3fArray const& points, VtVec3iArray const& triangles,
+                  float *vertices, unsigned int *triangleIndices)
+{
+    TRACE_SCOPE("HdLuxCoreMesh vertex packing");
+    TRACE_COUNTER_DELTA("HdLuxCore packed triangles", triangles.size());
 
-				if (!isBoundaryVertex[e.vIndex[0]]) {
-					cornerVertexIndices.push_back(e.vIndex[0]);
-					cornerWeights.push_back(10.f);
-					isBoundaryVertex[e.vIndex[0]] = true;
-				}
+    memcpy(triangleIndices, triangles.cdata(), triangles.size() * sizeof(GfVec3i));
+    memcpy(vertices, points.cdata(), points.size() * sizeof(GfVec3f));
+}
 
-				if (!isBoundaryVertex[e.vIndex[1]]) {
-					cornerVertexIndices.push_back(e.vIndex[1]);
-					cornerWeights.push_back(10.f);
-					isBoundaryVertex[e.vIndex[1]] = true;
-				}
-			}
-		}
+int
+HdLuxCoreGetSubdivisionLevels(TfToken const& scheme, int refineLevel)
+{
+    // Polygonal and bilinear meshes keep their faces; smooth schemes are
+    // approximated by loop subdivision of the triangulated mesh
+    if (refineLevel <= 0 || scheme == PxOsdOpenSubdivTokens->none ||
+        scheme == PxOsdOpenSubdivTokens->bilinear) {
+        return 0;
+    }
 
-		// Initialize TopologyDescriptor corners if I have some
-		if (cornerVertexIndices.size() > 0) {
-			desc.numCorners = cornerVertexIndices.size();
-			desc.cornerVertexIndices = &cornerVertexIndices[0];
-			desc.cornerWeights = &cornerWeights[0];
-		}
+    return refineLevel + 1;
+}
+
+int
+HdLuxCoreMesh::_GetSubdivisionLevels() const
+{
+    return HdLuxCoreGetSubdivisionLevels(_topology.GetScheme(), _refineLevel);
+}
+
+void
+HdLuxCoreMesh::_RefineLoop(int levels,
+                           VtVec3fArray *points,
+                           VtVec3iArray *triangles) const
+{
+	// The following OpenSubdiv code is adapted from the LuxCore rendering system
+
+	// -- BEGIN OPEN SUBDIBV -- //
+
+	Sdc::Options options;
+	options.SetVtxBoundaryInterpolation(Sdc::Options::VTX_BOUNDARY_EDGE_AND_CORNER);
+
+	Far::TopologyDescriptor desc;
+	desc.numVertices = points->size();
+	desc.numFaces = triangles->size();
+	vector<int> vertPerFace(desc.numFaces, 3);
+	desc.numVertsPerFace = &vertPerFace[0];
+	desc.vertIndicesPerFace = (const int *)triangles->cdata();
+
+	// Look for mesh boundary edges, and make their vertices corners
+	vector<Far::Index> cornerVertexIndices =
+		HdLuxCoreFindBoundaryVertices(*triangles, desc.numVertices);
+	vector<float> cornerWeights(cornerVertexIndices.size(), 10.f);
+
+	// Initialize TopologyDescriptor corners if I have some
+	if (cornerVertexIndices.size() > 0) {
+		desc.numCorners = cornerVertexIndices.size();
+		desc.cornerVertexIndices = &cornerVertexIndices[0];
+		desc.cornerWeights = &cornerWeights[0];
+	}
 
 
-		// Instantiate a Far::TopologyRefiner from the descriptor
-		Sdc::SchemeType type = Sdc::SCHEME_LOOP;
-		Far::TopologyRefiner *refiner = Far::TopologyRefinerFactory<Far::TopologyDescriptor>::Create(desc,
-			Far::TopologyRefinerFactory<Far::TopologyDescriptor>::Options(type, options));
+	// Instantiate a Far::TopologyRefiner from the descriptor
+	TRACE_SCOPE("HdLuxCoreMesh topology refinement and stencil tables");
+	Sdc::SchemeType type = Sdc::SCHEME_LOOP;
+	Far::TopologyRefiner *refiner = Far::TopologyRefinerFactory<Far::TopologyDescriptor>::Create(desc,
+		Far::TopologyRefinerFactory<Far::TopologyDescriptor>::Options(type, options));
 
-		// Complexity
-		refiner->RefineUniform(Far::TopologyRefiner::UniformOptions(_refineLevel + 1));
+	// Complexity
+	refiner->RefineUniform(Far::TopologyRefiner::UniformOptions(levels));
 
-		Far::StencilTableFactory::Options stencilOptions;
-		stencilOptions.generateOffsets = true;
-		stencilOptions.generateIntermediateLevels = false;
+	Far::StencilTableFactory::Options stencilOptions;
+	stencilOptions.generateOffsets = true;
+	stencilOptions.generateIntermediateLevels = false;
 
-		const Far::StencilTable *stencilTable = Far::StencilTableFactory::Create(*refiner, stencilOptions);
+	const Far::StencilTable *stencilTable = Far::StencilTableFactory::Create(*refiner, stencilOptions);
 
-		Far::PatchTableFactory::Options patchOptions;
-		patchOptions.SetEndCapType(
-			Far::PatchTableFactory::Options::ENDCAP_BSPLINE_BASIS);
+	Far::PatchTableFactory::Options patchOptions;
+	patchOptions.SetEndCapType(
+		Far::PatchTableFactory::Options::ENDCAP_BSPLINE_BASIS);
 
-		const Far::PatchTable *patchTable =
-			Far::PatchTableFactory::Create(*refiner, patchOptions);
+	const Far::PatchTable *patchTable =
+		Far::PatchTableFactory::Create(*refiner, patchOptions);
 
-		// Append local point stencils
-		if (const Far::StencilTable *localPointStencilTable =
-			patchTable->GetLocalPointStencilTable()) {
-			if (const Far::StencilTable *combinedTable =
-				Far::StencilTableFactory::AppendLocalPointStencilTable(
-					*refiner, stencilTable, localPointStencilTable)) {
-				delete stencilTable;
-				stencilTable = combinedTable;
-			}
+	// Append local point stencils
+	if (const Far::StencilTable *localPointStencilTable =
+		patchTable->GetLocalPointStencilTable()) {
+		if (const Far::StencilTable *combinedTable =
+			Far::StencilTableFactory::AppendLocalPointStencilTable(
+				*refiner, stencilTable, localPointStencilTable)) {
+			delete stencilTable;
+			stencilTable = combinedTable;
 		}
+	}
 
-		// Setup a buffer for vertex primvar data
-		const unsigned int vertsCount = refiner->GetLevel(0).GetNumVertices();
-		const unsigned int totalVertsCount = vertsCount + refiner->GetNumVerticesTotal();
+	// Setup a buffer for vertex primvar data
+	const unsigned int vertsCount = refiner->GetLevel(0).GetNumVertices();
+	const unsigned int totalVertsCount = vertsCount + refiner->GetNumVerticesTotal();
 
-		// Vertices
-		Osd::CpuVertexBuffer *vertsBuffer = BuildBuffer<3>(
-			stencilTable, (const float *)_points.cdata(),
-			vertsCount, totalVertsCount);
+	// Vertices
+	Osd::CpuVertexBuffer *vertsBuffer = HdLuxCoreBuildBuffer<3>(
+		stencilTable, (const float *)points->cdata(),
+		vertsCount, totalVertsCount);
 
-		// New triangles
-		unsigned int newTrisCount = 0;
-		for (int array = 0; array < patchTable->GetNumPatchArrays(); ++array)
-			for (int patch = 0; patch < patchTable->GetNumPatches(array); ++patch)
-				++newTrisCount;
+	// New triangles
+	unsigned int newTrisCount = 0;
+	for (int array = 0; array < patchTable->GetNumPatchArrays(); ++array)
+		for (int patch = 0; patch < patchTable->GetNumPatches(array); ++patch)
+			++newTrisCount;
 
-		VtVec3iArray newTris = VtVec3iArray(newTrisCount);
+	VtVec3iArray newTris = VtVec3iArray(newTrisCount);
 
-		unsigned int triIndex = 0;
-		unsigned int maxVertIndex = 0;
-		for (int array = 0; array < patchTable->GetNumPatchArrays(); ++array) {
-			for (int patch = 0; patch < patchTable->GetNumPatches(array); ++patch) {
-				const Far::ConstIndexArray faceVerts =
-					patchTable->GetPatchVertices(array, patch);
+	unsigned int triIndex = 0;
+	unsigned int maxVertIndex = 0;
+	for (int array = 0; array < patchTable->GetNumPatchArrays(); ++array) {
+		for (int patch = 0; patch < patchTable->GetNumPatches(array); ++patch) {
+			const Far::ConstIndexArray faceVerts =
+				patchTable->GetPatchVertices(array, patch);
 
-				assert(faceVerts.size() == 3);
-				newTris[triIndex][0] = faceVerts[0] - vertsCount;
-				newTris[triIndex][1] = faceVerts[1] - vertsCount;
-				newTris[triIndex][2] = faceVerts[2] - vertsCount;
+			assert(faceVerts.size() == 3);
+			newTris[triIndex][0] = faceVerts[0] - vertsCount;
+			newTris[triIndex][1] = faceVerts[1] - vertsCount;
+			newTris[triIndex][2] = faceVerts[2] - vertsCount;
 
-				maxVertIndex = Max((int)maxVertIndex, Max(newTris[triIndex][0], Max(newTris[triIndex][1], newTris[triIndex][2])));
+			maxVertIndex = Max((int)maxVertIndex, Max(newTris[triIndex][0], Max(newTris[triIndex][1], newTris[triIndex][2])));
 
-				++triIndex;
-			}
+			++triIndex;
 		}
+	}
 
-		// I don't sincerely know how to get this obvious value out of OpenSubdiv
-		const u_int newVertsCount = maxVertIndex + 1;
+	// I don't sincerely know how to get this obvious value out of OpenSubdiv
+	const u_int newVertsCount = maxVertIndex + 1;
 
-		// New vertices
-		VtVec3fArray newVerts = VtVec3fArray(newVertsCount);
-		const float *refinedVerts = vertsBuffer->BindCpuBuffer() + 3 * vertsCount;
+	// New vertices
+	VtVec3fArray newVerts = VtVec3fArray(newVertsCount);
+	const float *refinedVerts = vertsBuffer->BindCpuBuffer() + 3 * vertsCount;
 
-		for (unsigned int i = 0; i < newVertsCount; i++) {
-			newVerts[i][0] = refinedVerts[i * 3 + 0];
-			newVerts[i][1] = refinedVerts[i * 3 + 1];
-			newVerts[i][2] = refinedVerts[i * 3 + 2];
-		}
+	for (unsigned int i = 0; i < newVertsCount; i++) {
+		newVerts[i][0] = refinedVerts[i * 3 + 0];
+		newVerts[i][1] = refinedVerts[i * 3 + 1];
+		newVerts[i][2] = refinedVerts[i * 3 + 2];
+	}
 
-		_triangulatedIndices = newTris;
-		_points = newVerts;
+	*triangles = newTris;
+	*points = newVerts;
 
-		// -- END OPEN SUBDIBV -- //
-	}
+	delete vertsBuffer;
+	delete patchTable;
+	delete stencilTable;
+	delete refiner;
 
+	// -- END OPEN SUBDIBV -- //
+}
 
-    // Alloc a LuxCore triangle buffer and copy the USD mesh's triangle indicies into it
-    unsigned int *triangle_indicies = (unsigned int *)Scene::AllocTrianglesBuffer(_triangulatedIndices.size());
-    triangle_indicies = (unsigned int *)_triangulatedIndices.cdata();
+void
+HdLuxCoreMesh::_DefineLuxCoreShape(Scene *lc_scene,
+                                   std::string const& shapeName,
+                                   int levels) const
+{
+    VtVec3fArray points = _points;
+    VtVec3iArray triangles = _triangulatedIndices;
 
-    float *verticies = (float *)Scene::AllocVerticesBuffer(_points.size());
-    for (unsigned int i = 0; i < _points.size(); i++) {
-        verticies[i*3+0] = _points[i][0];
-        verticies[i*3+1] = _points[i][1];
-        verticies[i*3+2] = _points[i][2];
+    if (levels > 0) {
+        _RefineLoop(levels, &points, &triangles);
     }
 
-    lc_scene->DefineMesh(id.GetString(), _points.size(), _triangulatedIndices.size(), verticies, triangle_indicies,  NULL, NULL, NULL, NULL);
+    // LuxCore takes ownership of the buffers passed to DefineMesh(), so they
+    // must be allocated by LuxCore and hold their own copy of the data.
+    unsigned int *triangle_indicies = (unsigned int *)Scene::AllocTrianglesBuffer(triangles.size());
+    float *verticies = (float *)Scene::AllocVerticesBuffer(points.size());
+    HdLuxCorePackMesh(points, triangles, verticies, triangle_indicies);
+
+    TRACE_SCOPE("HdLuxCoreMesh DefineMesh");
+    lc_scene->DefineMesh(shapeName, points.size(), triangles.size(), verticies, triangle_indicies, NULL, NULL, NULL, NULL);
+}
+
+bool
+HdLuxCoreMesh::CreateLuxCoreTriangleMesh(HdRenderParam* renderParam)
+{
+    HDLUXCORE_TRACE_FUNCTION();
+
+    Scene *lc_scene = reinterpret_cast<HdLuxCoreRenderParam*>(renderParam)->_scene;
+
+    // Used to name the type of mesh in LuxCore
+    SdfPath const& id = GetId();
+
+    if (lc_scene->IsMeshDefined(id.GetString())) {
+        return false;
+    }
+
+    // Triangulate the input faces.
+    HdMeshUtil meshUtil(&_topology, GetId());
+    meshUtil.ComputeTriangleIndices(&_triangulatedIndices,
+        &_trianglePrimitiveParams);
+
+    // Bounding sphere of the control points, used to estimate the
+    // projected size of each instance for level of detail selection.
+    GfRange3d bounds;
+    for (GfVec3f const& p : _points) {
+        bounds.UnionWith(GfVec3d(p));
+    }
+    _boundsCenter = bounds.IsEmpty() ? GfVec3d(0.0) : bounds.GetMidpoint();
+    _boundsRadius = bounds.IsEmpty() ? 0.0 : bounds.GetSize().GetLength() * 0.5;
+
+    // Hash of the full resolution shape, the basis of this mesh's
+    // contribution to the scene hash
+    int const levels = _GetSubdivisionLevels();
+    _shapeHash = ArchHash64((char const*)&levels, sizeof(levels));
+    _shapeHash = ArchHash64((char const*)_points.cdata(),
+                            _points.size() * sizeof(GfVec3f), _shapeHash);
+    _shapeHash = ArchHash64((char const*)_triangulatedIndices.cdata(),
+                            _triangulatedIndices.size() * sizeof(GfVec3i), _shapeHash);
+
+    // Coarser levels of detail are defined lazily, the first time an
+    // instance needs them.
+    _DefineLuxCoreShape(lc_scene, id.GetString(), _GetSubdivisionLevels());
 
     return true;
 }
@@ -514,6 +659,259 @@ HdLuxCoreMesh::_UpdateComputedPrimvarSources(HdSceneDelegate* sceneDelegate,
     return compPrimvarNames;
 }
 
+size_t
+HdLuxCoreMesh::GetMemoryUsage() const
+{
+    return _points.size() * sizeof(GfVec3f) +
+        _triangulatedIndices.size() * sizeof(GfVec3i) +
+        _normals.size() * sizeof(GfVec3f) +
+        _computedNormals.size() * sizeof(GfVec3f) +
+        _uvs.size() * sizeof(GfVec3f) +
+        _transforms.size() * sizeof(GfMatrix4d) +
+        _instanceColors.size() * sizeof(GfVec3f) +
+        _instanceIds.size() * sizeof(int);
+}
+
+std::string
+HdLuxCoreMesh::GetInstanceName(size_t index) const
+{
+    return GetId().GetString() + std::to_string(index);
+}
+
+std::string
+HdLuxCoreMesh::_GetLodShapeName(int lod) const
+{
+    if (lod == 0) {
+        return GetId().GetString();
+    }
+
+    return GetId().GetString() + "_lod" + std::to_string(lod);
+}
+
+// Return the level of detail for an instance with the given projected
+// radius: 0 at or above the threshold, one level coarser per halving.
+static int
+_LodForProjectedSize(double pixels, double threshold, int maxLod)
+{
+    if (pixels >= threshold) {
+        return 0;
+    }
+    if (pixels <= 0.0) {
+        return maxLod;
+    }
+
+    // Each level of loop subdivision quadruples the triangle count, which
+    // matches halving the projected radius.
+    int const lod = (int)std::ceil(std::log2(threshold / pixels));
+    return std::min(lod, maxLod);
+}
+
+int
+HdLuxCoreSelectInstanceLod(GfMatrix4d const& transform,
+                           GfVec3d const& center, double radius,
+                           int maxLod, int currentLod,
+                           HdLuxCoreLodContext const& lodContext)
+{
+    // Conservative world space bounding sphere of this instance
+    double const scale = std::max(transform.GetRow3(0).GetLength(),
+        std::max(transform.GetRow3(1).GetLength(), transform.GetRow3(2).GetLength()));
+    double const worldRadius = radius * scale;
+    double const distance =
+        (transform.Transform(center) - lodContext.cameraPosition).GetLength();
+
+    // Instances the camera is inside of always get the full shape
+    if (distance <= worldRadius) {
+        return 0;
+    }
+
+    double const pixels = worldRadius * lodContext.pixelScale / distance;
+
+    // Keep the current level while the projected size stays within the
+    // hysteresis band around it.
+    if (currentLod >= 0) {
+        int const finest = _LodForProjectedSize(
+            pixels * (1.0 + lodContext.hysteresis),
+            lodContext.pixelThreshold, maxLod);
+        int const coarsest = _LodForProjectedSize(
+            pixels * (1.0 - lodContext.hysteresis),
+            lodContext.pixelThreshold, maxLod);
+        if (currentLod >= finest && currentLod <= coarsest) {
+            return currentLod;
+        }
+    }
+
+    return _LodForProjectedSize(pixels, lodContext.pixelThreshold, maxLod);
+}
+
+std::vector<int>
+HdLuxCoreMesh::_SelectInstanceLods(HdLuxCoreLodContext const *lodContext) const
+{
+    std::vector<int> lods(_transforms.size(), 0);
+
+    int const maxLod = _GetSubdivisionLevels();
+    if (!lodContext || !lodContext->enabled || maxLod == 0 ||
+        GetInstancerId().IsEmpty()) {
+        return lods;
+    }
+
+    for (size_t i = 0; i < _transforms.size(); i++) {
+        int const current = i < _instanceLods.size() ? _instanceLods[i] : -1;
+        lods[i] = HdLuxCoreSelectInstanceLod(*_transforms[i], _boundsCenter,
+                                             _boundsRadius, maxLod, current,
+                                             *lodContext);
+    }
+
+    return lods;
+}
+
+// Pack a color into an object id as 8-bit RGB, the encoding read back by
+// the objectidcolor texture.
+static unsigned int
+_PackColorId(GfVec3f const& c)
+{
+    unsigned int const r = (unsigned int)(GfClamp(c[0], 0.0f, 1.0f) * 255.0f + 0.5f);
+    unsigned int const g = (unsigned int)(GfClamp(c[1], 0.0f, 1.0f) * 255.0f + 0.5f);
+    unsigned int const b = (unsigned int)(GfClamp(c[2], 0.0f, 1.0f) * 255.0f + 0.5f);
+    return r | (g << 8) | (b << 16);
+}
+
+bool
+HdLuxCoreMesh::UpdateLuxCoreObjects(HdRenderParam *renderParam,
+                                    HdLuxCoreLodContext const *lodContext)
+{
+    HdLuxCoreRenderParam *lc_renderParam = reinterpret_cast<HdLuxCoreRenderParam*>(renderParam);
+    Scene *lc_scene = lc_renderParam->_scene;
+
+    // Toggling scene colors re-binds every object
+    bool const sceneColors = lc_renderParam->GetSceneColorsEnabled();
+    if (sceneColors != _sceneColorsRendered) {
+        _objects_dirty = true;
+        _sceneColorsRendered = sceneColors;
+    }
+
+    // Instances with per-instance colors share a material that reads the
+    // color back from the object id, as do meshes shaded with scene colors.
+    bool const hasColors = _instanceColors.size() == _transforms.size();
+    bool const hasDisplayColor = sceneColors && _hasDisplayColor;
+    bool const hasIds = _instanceIds.size() == _transforms.size();
+    std::string const materialName = !_visible ? "mat_null" :
+        (hasColors || hasDisplayColor ? "mat_instancecolor" : "mat_default");
+
+    // Levels of detail only need to be re-evaluated when the instances or
+    // the view changed.
+    int const lodContextVersion = lodContext ? lodContext->version : -1;
+    if (!_objects_dirty && lodContextVersion == _lodContextVersion) {
+        if (_visible != _visible_rendered) {
+            // Hidden objects stay resident and are re-bound to the null
+            // material, which is a material-only edit: the accelerator is
+            // left untouched.
+            for (int i = 0; i < _instances_rendered; i++) {
+                lc_scene->UpdateObjectMaterial(GetInstanceName(i), materialName);
+            }
+            _visible_rendered = _visible;
+            return true;
+        }
+
+        return false;
+    }
+
+    std::vector<int> const lods = _SelectInstanceLods(lodContext);
+    bool edited = false;
+
+    // Each object carries its own transformation property, so LuxCore
+    // wraps the shared shape in an instance instead of transforming the
+    // shape's vertices in place. Objects can then be redefined or deleted
+    // without undoing their previous transformation first.
+    for (size_t i = 0; i < _transforms.size(); i++) {
+        bool const lodChanged = i >= _instanceLods.size() || lods[i] != _instanceLods[i];
+        if (!_objects_dirty && !lodChanged && (int)i < _instances_rendered) {
+            continue;
+        }
+
+        std::string const shapeName = _GetLodShapeName(lods[i]);
+        if (!lc_scene->IsMeshDefined(shapeName)) {
+            _DefineLuxCoreShape(lc_scene, shapeName,
+                                _GetSubdivisionLevels() - lods[i]);
+        }
+
+        std::string const instanceName = GetInstanceName(i);
+        GfMatrix4f m = GfMatrix4f(*_transforms[i]);
+        float const *items = m.GetArray();
+
+        luxrays::Property transformation("scene.objects." + instanceName + ".transformation");
+        for (int j = 0; j < 16; j++) {
+            transformation.Add(items[j]);
+        }
+
+        luxrays::Properties objectProps;
+        objectProps <<
+            luxrays::Property("scene.objects." + instanceName + ".shape")(shapeName) <<
+            luxrays::Property("scene.objects." + instanceName + ".material")(materialName) <<
+            transformation;
+
+        // The objectidcolor texture decodes the id as 8-bit RGB, so a
+        // color takes precedence over an authored id.
+        if (hasColors) {
+            objectProps << luxrays::Property("scene.objects." + instanceName + ".id")(
+                _PackColorId(_instanceColors[i]));
+        } else if (hasDisplayColor) {
+            objectProps << luxrays::Property("scene.objects." + instanceName + ".id")(
+                _PackColorId(_displayColor));
+        } else if (hasIds) {
+            objectProps << luxrays::Property("scene.objects." + instanceName + ".id")((unsigned int)_instanceIds[i]);
+        }
+
+        lc_scene->Parse(objectProps);
+        edited = true;
+    }
+
+    // Drop the objects of instances that no longer exist
+    for (int i = _transforms.size(); i < _instances_rendered; i++) {
+        lc_scene->DeleteObject(GetInstanceName(i));
+        edited = true;
+    }
+
+    // Objects re-bound above already use the current material; the others
+    // only need re-binding if visibility changed.
+    if (_visible != _visible_rendered && !_objects_dirty) {
+        for (size_t i = 0; i < _transforms.size() && (int)i < _instances_rendered; i++) {
+            if (lods[i] == _instanceLods[i]) {
+                lc_scene->UpdateObjectMaterial(GetInstanceName(i), materialName);
+                edited = true;
+            }
+        }
+    }
+
+    // Levels of detail are left out of the content hash: they follow the
+    // view, not the scene.
+    if (_objects_dirty || _visible != _visible_rendered) {
+        uint64_t hash = _shapeHash;
+        for (GfMatrix4d const* transform : _transforms) {
+            hash = ArchHash64((char const*)transform->GetArray(),
+                              16 * sizeof(double), hash);
+        }
+        hash = ArchHash64((char const*)_instanceColors.cdata(),
+                          _instanceColors.size() * sizeof(GfVec3f), hash);
+        hash = ArchHash64((char const*)_instanceIds.cdata(),
+                          _instanceIds.size() * sizeof(int), hash);
+        hash = ArchHash64(materialName.c_str(), materialName.size(), hash);
+        if (hasDisplayColor) {
+            hash = ArchHash64((char const*)_displayColor.GetArray(),
+                              sizeof(GfVec3f), hash);
+        }
+        lc_renderParam->SetContentHash(
+            GetId().GetString(), hash);
+    }
+
+    _instanceLods = lods;
+    _lodContextVersion = lodContextVersion;
+    _instances_rendered = _transforms.size();
+    _visible_rendered = _visible;
+    _objects_dirty = false;
+
+    return edited;
+}
+
 bool
 HdLuxCoreMesh::IsValidTransform(GfMatrix4f m)
 {
@@ -28,7 +28,18 @@
 #include "pxr/imaging/hd/mesh.h"
 #include "pxr/imaging/hd/enums.h"
 #include "pxr/imaging/hd/vertexAdjacency.h"
+#include "pxr/base/gf/matrix4d.h"
 #include "pxr/base/gf/matrix4f.h"
+#include "pxr/base/gf/vec3d.h"
+#include "pxr/base/tf/token.h"
+#include "pxr/base/vt/types.h"
+
+#include <opensubdiv/far/stencilTable.h>
+#include <opensubdiv/osd/cpuVertexBuffer.h>
+
+#include <luxcore/luxcore.h>
+#include <cstdint>
+#include <vector>
 
 
 PXR_NAMESPACE_OPEN_SCOPE
@@ -73,6 +84,66 @@ public:
 	}
 };
 
+/// Return the vertices on a boundary edge of \p triangles, an edge used by
+/// a single triangle, each once. The mesh has \p vertexCount vertices.
+/// HdLuxCoreMesh pins them as corners when it refines the mesh.
+std::vector<int> HdLuxCoreFindBoundaryVertices(VtVec3iArray const& triangles,
+                                               size_t vertexCount);
+
+/// Create a vertex buffer of \p totalCount elements of \p DIMENSIONS
+/// floats, holding the \p count control values in \p data followed by the
+/// values \p stencilTable refines from them. The caller owns the buffer.
+/// Instantiated for DIMENSIONS = 3.
+template <unsigned int DIMENSIONS>
+OpenSubdiv::Osd::CpuVertexBuffer *HdLuxCoreBuildBuffer(
+    OpenSubdiv::Far::StencilTable const *stencilTable, float const *data,
+    unsigned int count, unsigned int totalCount);
+
+/// Copy \p points and \p triangles into the buffers \p vertices and
+/// \p triangleIndices, in the layout luxcore::Scene::DefineMesh() takes.
+void HdLuxCorePackMesh(VtVec3fArray const& points,
+                       VtVec3iArray const& triangles,
+                       float *vertices, unsigned int *triangleIndices);
+
+/// \struct HdLuxCoreLodContext
+///
+/// View-dependent state used by HdLuxCoreMesh to pick a level of detail for
+/// each instance from its projected screen size. The render pass owns it and
+/// bumps the version whenever the camera or the LOD settings change.
+struct HdLuxCoreLodContext {
+    /// Whether screen-space LOD selection is enabled.
+    bool enabled = false;
+    /// World space position of the camera.
+    GfVec3d cameraPosition = GfVec3d(0.0);
+    /// Projected radius, in pixels, of a unit sphere at unit distance.
+    double pixelScale = 1.0;
+    /// Projected radius, in pixels, below which an instance drops to the next
+    /// coarser level. Each further halving drops one more level.
+    double pixelThreshold = 32.0;
+    /// Fraction by which an instance's projected size must cross a threshold
+    /// before it switches level, so small camera moves don't re-bin instances.
+    double hysteresis = 0.25;
+    /// Incremented whenever any of the above changes.
+    int version = 0;
+};
+
+/// Return the levels of loop subdivision applied to the full resolution
+/// shape of a mesh with subdivision \p scheme, displayed at
+/// \p refineLevel. Polygonal and bilinear meshes, and refine level 0,
+/// aren't subdivided. Instances can drop to coarser levels of detail, down
+/// to the control mesh.
+int HdLuxCoreGetSubdivisionLevels(TfToken const& scheme, int refineLevel);
+
+/// Return the level of detail, from 0 for the full resolution shape to
+/// \p maxLod, of an instance placed by \p transform of a shape bounded by
+/// the sphere \p center, \p radius in object space. \p currentLod is the
+/// instance's current level, kept while its projected size stays in the
+/// hysteresis band around it, or -1 if it has none.
+int HdLuxCoreSelectInstanceLod(GfMatrix4d const& transform,
+                               GfVec3d const& center, double radius,
+                               int maxLod, int currentLod,
+                               HdLuxCoreLodContext const& lodContext);
+
 /// \class HdLuxCoreMesh
 ///
 /// An HdLuxCore representation of a subdivision surface or poly-mesh object.
@@ -147,6 +218,27 @@ public:
     virtual void Finalize(HdRenderParam *renderParam) override;
 
     bool CreateLuxCoreTriangleMesh(HdRenderParam *renderParam);
+
+    /// Create, move or re-bind the LuxCore objects instancing this mesh's
+    /// shape so they match the last synced transforms and visibility.
+    /// Hidden objects stay resident in the scene and are bound to the null
+    /// material, so toggling visibility never touches the accelerator.
+    /// Per-instance colors are packed into the object id and rendered by a
+    /// material shared by all instances.
+    /// Must be called between BeginSceneEdit() and EndSceneEdit().
+    ///
+    /// With \p lodContext enabled, each instance of a refined prototype is
+    /// bound to the subdivision level matching its projected screen size.
+    /// Coarser levels are defined as separate LuxCore shapes on first use.
+    ///   \param renderParam An HdLuxCoreRenderParam object
+    ///   \param lodContext The current level of detail state, or nullptr to
+    ///                     always use the full resolution shape.
+    ///   \return True if the LuxCore scene was edited.
+    bool UpdateLuxCoreObjects(HdRenderParam *renderParam,
+                              HdLuxCoreLodContext const *lodContext = nullptr);
+
+    /// Return the name of the LuxCore object for instance \p index.
+    std::string GetInstanceName(size_t index) const;
     
     virtual TfMatrix4dVector GetTransforms() const {
         return _transforms;
@@ -160,9 +252,9 @@ public:
 		return _instances_rendered;
 	}
 
-	virtual void SetInstancesRendered(int count) {
-		_instances_rendered = count;
-	}
+    /// Return the bytes of translated geometry and instance data held for
+    /// LuxCore, for HdLuxCoreRenderDelegate::GetRenderStats().
+    size_t GetMemoryUsage() const;
 
     bool IsValidTransform(GfMatrix4f m);
     
@@ -216,6 +308,29 @@ private:
                                HdInterpolation interpolation,
                                bool refined);
 
+    // Return the number of loop subdivision levels applied to the full
+    // resolution shape; 0 if the mesh isn't refined.
+    int _GetSubdivisionLevels() const;
+
+    // Apply \p levels of uniform loop subdivision to a triangle mesh.
+    void _RefineLoop(int levels, VtVec3fArray *points,
+                     VtVec3iArray *triangles) const;
+
+    // Define a LuxCore shape named \p shapeName from the triangulated
+    // control mesh, refined by \p levels of loop subdivision.
+    void _DefineLuxCoreShape(luxcore::Scene *lc_scene,
+                             std::string const& shapeName,
+                             int levels) const;
+
+    // Return the LuxCore shape name for level of detail \p lod, where 0 is
+    // the full resolution shape.
+    std::string _GetLodShapeName(int lod) const;
+
+    // Pick a level of detail for each instance; all 0 if LOD is disabled or
+    // doesn't apply to this mesh.
+    std::vector<int> _SelectInstanceLods(
+        HdLuxCoreLodContext const *lodContext) const;
+
 private:
     // Note:
     // Every HdLuxCoreMesh is treated as instanced; if there's no instancer,
@@ -275,7 +390,29 @@ private:
 	int _refineLevel;
 	bool _visible = true;
 
+	// Per-instance primvars forwarded to LuxCore as object ids; empty if
+	// not authored on the instancer.
+	VtVec3fArray _instanceColors;
+	VtIntArray _instanceIds;
+
+	// The mean displayColor of the mesh, used with scene colors.
+	GfVec3f _displayColor = GfVec3f(1.0f);
+	bool _hasDisplayColor = false;
+
+	// Bounding sphere of the control points in object space.
+	GfVec3d _boundsCenter = GfVec3d(0.0);
+	double _boundsRadius = 0.0;
+
+	// Hash of the full resolution shape, see CreateLuxCoreTriangleMesh().
+	uint64_t _shapeHash = 0;
+
+	// State of the LuxCore objects last written by UpdateLuxCoreObjects().
+	std::vector<int> _instanceLods;
+	int _lodContextVersion = -1;
 	int _instances_rendered = 0;
+	bool _visible_rendered = true;
+	bool _objects_dirty = false;
+	bool _sceneColorsRendered = false;
 
     // This class does not support copying.
     HdLuxCoreMesh(const HdLuxCoreMesh&)             = delete;
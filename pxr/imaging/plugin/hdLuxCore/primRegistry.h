@@ -0,0 +1,100 @@
+#ifndef HDLUXCORE_PRIM_REGISTRY_H
+#define HDLUXCORE_PRIM_REGISTRY_H
+
+#include "pxr/pxr.h"
+#include "pxr/usd/sdf/path.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+///
+/// \class HdLuxCorePrimRegistry
+///
+/// The prims of one type created by the render delegate, for the render
+/// pass to iterate over. Prims may be inserted and removed from any thread,
+/// such as during Hydra's parallel sync. Every change bumps a generation
+/// counter; readers get an immutable snapshot of the registry, which is
+/// only rebuilt when the generation moved, so reading an unchanged registry
+/// takes no lock.
+///
+/// Snapshots hold plain pointers: a prim must not be destroyed while a
+/// snapshot containing it is in use. Hydra destroys prims between render
+/// pass executions, so a snapshot taken in HdRenderPass::_Execute() is
+/// valid until it returns.
+///
+template <class T>
+class HdLuxCorePrimRegistry {
+public:
+    typedef std::shared_ptr<const std::vector<T*>> Snapshot;
+
+    HdLuxCorePrimRegistry()
+        : _snapshot(std::make_shared<const std::vector<T*>>()) {}
+
+    /// Register \p prim under \p id, replacing any prim registered there.
+    void Insert(SdfPath const& id, T *prim) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _prims[id] = prim;
+        _generation.fetch_add(1, std::memory_order_release);
+    }
+
+    /// Remove the prim registered under \p id.
+    ///   \return True if a prim was registered under \p id.
+    bool Remove(SdfPath const& id) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (_prims.erase(id) == 0) {
+            return false;
+        }
+        _generation.fetch_add(1, std::memory_order_release);
+        return true;
+    }
+
+    /// Return a counter that changes whenever a prim is inserted or
+    /// removed.
+    uint64_t GetGeneration() const {
+        return _generation.load(std::memory_order_acquire);
+    }
+
+    /// Return the registered prims, in no particular order.
+    Snapshot GetSnapshot() const {
+        if (_snapshotGeneration.load(std::memory_order_acquire) == GetGeneration()) {
+            return std::atomic_load(&_snapshot);
+        }
+
+        std::lock_guard<std::mutex> guard(_mutex);
+        uint64_t const generation = GetGeneration();
+        if (_snapshotGeneration.load(std::memory_order_relaxed) != generation) {
+            auto prims = std::make_shared<std::vector<T*>>();
+            prims->reserve(_prims.size());
+            for (auto const& entry : _prims) {
+                prims->push_back(entry.second);
+            }
+            std::atomic_store(&_snapshot, Snapshot(std::move(prims)));
+            _snapshotGeneration.store(generation, std::memory_order_release);
+        }
+
+        return std::atomic_load(&_snapshot);
+    }
+
+private:
+    mutable std::mutex _mutex;
+    std::unordered_map<SdfPath, T*, SdfPath::Hash> _prims;
+    std::atomic<uint64_t> _generation{0};
+
+    // The last snapshot built and the generation it reflects
+    mutable Snapshot _snapshot;
+    mutable std::atomic<uint64_t> _snapshotGeneration{0};
+
+    // This class does not support copying.
+    HdLuxCorePrimRegistry(const HdLuxCorePrimRegistry&) = delete;
+    HdLuxCorePrimRegistry &operator =(const HdLuxCorePrimRegistry&) = delete;
+};
+
+PXR_NAMESPACE_CLOSE_SCOPE
+
+#endif // HDLUXCORE_PRIM_REGISTRY_H
@@ -23,10 +23,13 @@
 //
 #include "pxr/imaging/glf/glew.h"
 #include "pxr/imaging/hdLuxCore/renderDelegate.h"
+#include "pxr/imaging/hdLuxCore/trace.h"
 
 #include "pxr/imaging/hdLuxCore/instancer.h"
 #include "pxr/imaging/hdLuxCore/renderParam.h"
 #include "pxr/imaging/hdLuxCore/renderPass.h"
+#include "pxr/imaging/hdLuxCore/renderStats.h"
+#include "pxr/imaging/hdLuxCore/threadAffinity.h"
 #include "pxr/imaging/hdLuxCore/camera.h"
 
 #include "pxr/imaging/hd/extComputation.h"
@@ -35,26 +38,17 @@
 
 
 #include "pxr/imaging/hd/bprim.h"
-#include <boost/current_function.hpp>
-
+#include "pxr/base/gf/math.h"
+#include "pxr/base/tf/stringUtils.h"
+#include "pxr/base/arch/hash.h"
+#include "pxr/base/work/threadLimits.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
 #include <iostream>
-#include <chrono>
-#include <ctime>
 using namespace std;
 
-int logit(std::string message)
-{
-    auto timenow = chrono::system_clock::to_time_t(chrono::system_clock::now()); 
-    char *time = ctime(&timenow);
-
-    // remove the trailing newline
-    time[strlen(time) - 1] = '\0';
-
-    cout << "PLUGIN: " << time << " Thread: " << std::this_thread::get_id() << " " << message << endl << std::flush;
-
-    return 0;
-}
-
 PXR_NAMESPACE_OPEN_SCOPE
 
 TF_DEFINE_PUBLIC_TOKENS(HdLuxCoreRenderSettingsTokens, HDLUXCORE_RENDER_SETTINGS_TOKENS);
@@ -68,9 +62,26 @@ const TfTokenVector HdLuxCoreRenderDelegate::SUPPORTED_SPRIM_TYPES =
 {
     HdPrimTypeTokens->camera,
     HdPrimTypeTokens->extComputation,
-    HdPrimTypeTokens->sphereLight
+    HdPrimTypeTokens->sphereLight,
+    HdPrimTypeTokens->distantLight,
+    HdPrimTypeTokens->rectLight,
+    HdPrimTypeTokens->diskLight,
+    HdPrimTypeTokens->cylinderLight,
+    HdPrimTypeTokens->domeLight
 };
 
+// Returns true if the sprim type is translated by HdLuxCoreLight
+static bool
+_IsLightType(TfToken const& typeId)
+{
+    return typeId == HdPrimTypeTokens->sphereLight ||
+           typeId == HdPrimTypeTokens->distantLight ||
+           typeId == HdPrimTypeTokens->rectLight ||
+           typeId == HdPrimTypeTokens->diskLight ||
+           typeId == HdPrimTypeTokens->cylinderLight ||
+           typeId == HdPrimTypeTokens->domeLight;
+}
+
 // Currently the plugin does not support textures and materials other than the default
 // Bprims will need ot be supported if textures are to be implemented
 const TfTokenVector HdLuxCoreRenderDelegate::SUPPORTED_BPRIM_TYPES =
@@ -85,16 +96,14 @@ HdResourceRegistrySharedPtr HdLuxCoreRenderDelegate::_resourceRegistry;
 void
 HdLuxCoreRenderDelegate::HandleLuxCoreError(const char* msg)
 {
-    logit(BOOST_CURRENT_FUNCTION);
-
-    return;
+    HdLuxCoreLogLuxCoreMessage(msg);
 }
 
 HdLuxCoreRenderDelegate::HdLuxCoreRenderDelegate()
     : HdRenderDelegate()
     
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     _Initialize();
 }
@@ -103,7 +112,7 @@ HdLuxCoreRenderDelegate::HdLuxCoreRenderDelegate(
     HdRenderSettingsMap const& settingsMap)
     : HdRenderDelegate(settingsMap)
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     _Initialize();
 }
@@ -111,9 +120,11 @@ HdLuxCoreRenderDelegate::HdLuxCoreRenderDelegate(
 void
 HdLuxCoreRenderDelegate::_Initialize()
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
+
+    luxcore::Init(HandleLuxCoreError);
 
-    luxcore::Init();
+    _sceneVersion.store(0);
     
     lc_scene = luxcore::Scene::Create();
 
@@ -124,13 +135,7 @@ HdLuxCoreRenderDelegate::_Initialize()
 
     // LuxCore requires at least one light source in order to initialize the renderer
     // This default light is removed later on unless lighting is missing from the USD scene file
-    lc_scene->Parse(
-        luxrays::Property("scene.lights.light_default.type")("point") <<
-        luxrays::Property("scene.lights.light_default.color")(1.0, 1.0, 1.0) <<
-        luxrays::Property("scene.lights.light_default.gain")(1.0, 1.0, 1.0) <<
-        luxrays::Property("scene.lights.light_default.direction")(1.0, 1.0, 1.0) <<
-        luxrays::Property("scene.lights.light_default.position")(1.0, 1.0, 1.0)
-    );
+    lc_scene->Parse(HdLuxCoreRenderParam::GetDefaultLightProperties());
 
     // Default material used for all renders
     lc_scene->Parse(
@@ -138,48 +143,195 @@ HdLuxCoreRenderDelegate::_Initialize()
         luxrays::Property("scene.materials.mat_default.kd")(.75f, .75f, .75f)
     );
 
-    // Use the PATHCPU engine for development
-    lc_config = luxcore::RenderConfig::Create(
-        luxrays::Property("renderengine.type")("PATHCPU") <<
-        luxrays::Property("sampler.type")("RANDOM"),
-        lc_scene
+    // Hidden objects are kept in the scene and bound to this fully
+    // transparent material, so visibility toggles never rebuild geometry
+    lc_scene->Parse(
+        luxrays::Property("scene.materials.mat_null.type")("null")
     );
 
-    lc_session = luxcore::RenderSession::Create(lc_config);
+    // Material shared by all instances carrying a per-instance displayColor.
+    // The color is packed into each object's id and decoded by the
+    // objectidcolor texture, so no per-instance material is needed.
+    lc_scene->Parse(
+        luxrays::Property("scene.textures.tex_instancecolor.type")("objectidcolor") <<
+        luxrays::Property("scene.materials.mat_instancecolor.type")("matte") <<
+        luxrays::Property("scene.materials.mat_instancecolor.kd")("tex_instancecolor")
+    );
+
+    // Populate the render settings exposed to the application
+    _settingDescriptors.push_back({"Enable ambient occlusion preview",
+        HdLuxCoreRenderSettingsTokens->enableAmbientOcclusion, VtValue(false)});
+    _settingDescriptors.push_back({"Enable scene colors",
+        HdLuxCoreRenderSettingsTokens->enableSceneColors, VtValue(false)});
+    _settingDescriptors.push_back({"Ambient occlusion samples per pixel",
+        HdLuxCoreRenderSettingsTokens->ambientOcclusionSamples, VtValue(16)});
+    _settingDescriptors.push_back({"Enable instance level of detail",
+        HdLuxCoreRenderSettingsTokens->enableInstanceLod, VtValue(false)});
+    _settingDescriptors.push_back({"Instance LOD pixel threshold",
+        HdLuxCoreRenderSettingsTokens->instanceLodPixelThreshold, VtValue(32.0f)});
+    _settingDescriptors.push_back({"Instance LOD hysteresis",
+        HdLuxCoreRenderSettingsTokens->instanceLodHysteresis, VtValue(0.25f)});
+    _settingDescriptors.push_back({"Light strategy (UNIFORM, POWER, LOG_POWER, DLS_CACHE)",
+        HdLuxCoreRenderSettingsTokens->lightStrategy, VtValue(std::string("LOG_POWER"))});
+    _settingDescriptors.push_back({"Persistent cache directory",
+        HdLuxCoreRenderSettingsTokens->persistentCacheDirectory, VtValue(std::string())});
+    _settingDescriptors.push_back({"Enable PhotonGI caches",
+        HdLuxCoreRenderSettingsTokens->enablePhotonGI, VtValue(false)});
+    _settingDescriptors.push_back({"PhotonGI indirect cache",
+        HdLuxCoreRenderSettingsTokens->photonGIIndirect, VtValue(true)});
+    _settingDescriptors.push_back({"PhotonGI caustic cache",
+        HdLuxCoreRenderSettingsTokens->photonGICaustic, VtValue(false)});
+    _settingDescriptors.push_back({"PhotonGI max photon count",
+        HdLuxCoreRenderSettingsTokens->photonGIMaxPhotonCount, VtValue(20000000)});
+    _settingDescriptors.push_back({"PhotonGI max photon depth",
+        HdLuxCoreRenderSettingsTokens->photonGIMaxDepth, VtValue(4)});
+    _settingDescriptors.push_back({"PhotonGI lookup radius",
+        HdLuxCoreRenderSettingsTokens->photonGILookupRadius, VtValue(0.15f)});
+    _settingDescriptors.push_back({"Enable light groups",
+        HdLuxCoreRenderSettingsTokens->enableLightGroups, VtValue(false)});
+    _settingDescriptors.push_back({"Tonemapper (AUTOLINEAR, LINEAR, REINHARD02)",
+        HdLuxCoreRenderSettingsTokens->tonemapper, VtValue(std::string("AUTOLINEAR"))});
+    _settingDescriptors.push_back({"Exposure (stops)",
+        HdLuxCoreRenderSettingsTokens->exposure, VtValue(0.0f)});
+    _settingDescriptors.push_back({"Gamma",
+        HdLuxCoreRenderSettingsTokens->gamma, VtValue(2.2f)});
+    _settingDescriptors.push_back({"Enable irradiance contour lines",
+        HdLuxCoreRenderSettingsTokens->enableContourLines, VtValue(false)});
+    _settingDescriptors.push_back({"Contour lines scale",
+        HdLuxCoreRenderSettingsTokens->contourLinesScale, VtValue(179.0f)});
+    _settingDescriptors.push_back({"Contour lines range",
+        HdLuxCoreRenderSettingsTokens->contourLinesRange, VtValue(100.0f)});
+    _settingDescriptors.push_back({"Contour lines steps",
+        HdLuxCoreRenderSettingsTokens->contourLinesSteps, VtValue(8)});
+
+    // Path tracing settings, the main levers on render time. Each bounce
+    // adds a ray cast and a light sample per path, so the cost of a sample
+    // grows roughly linearly with the path depth; the per-type depths cap
+    // bounces off diffuse, glossy and specular surfaces within the total.
+    _settingDescriptors.push_back({"Max total path depth",
+        HdLuxCoreRenderSettingsTokens->pathDepthTotal, VtValue(6)});
+    _settingDescriptors.push_back({"Max diffuse path depth",
+        HdLuxCoreRenderSettingsTokens->pathDepthDiffuse, VtValue(4)});
+    _settingDescriptors.push_back({"Max glossy path depth",
+        HdLuxCoreRenderSettingsTokens->pathDepthGlossy, VtValue(4)});
+    _settingDescriptors.push_back({"Max specular path depth",
+        HdLuxCoreRenderSettingsTokens->pathDepthSpecular, VtValue(6)});
+    // Clamping the variance of path contributions removes fireflies at no
+    // cost per sample, at the price of some energy loss. 0 disables it.
+    _settingDescriptors.push_back({"Radiance clamping max variance",
+        HdLuxCoreRenderSettingsTokens->clampingVarianceMax, VtValue(0.0f)});
+    // Russian roulette terminates paths after this depth with a probability
+    // based on their throughput, capped at the given value. A lower depth
+    // or cap makes deep paths cheaper and noisier.
+    _settingDescriptors.push_back({"Russian roulette start depth",
+        HdLuxCoreRenderSettingsTokens->russianRouletteDepth, VtValue(3)});
+    _settingDescriptors.push_back({"Russian roulette cap",
+        HdLuxCoreRenderSettingsTokens->russianRouletteCap, VtValue(0.5f)});
+
+    // The denoiser runs in the background once the film reaches the start
+    // sample count, then each time the count grows by the cadence factor,
+    // so denoising takes a bounded share of the render time.
+    _settingDescriptors.push_back({"Enable denoiser",
+        HdLuxCoreRenderSettingsTokens->enableDenoiser, VtValue(false)});
+    _settingDescriptors.push_back({"Denoiser start samples per pixel",
+        HdLuxCoreRenderSettingsTokens->denoiserStartSamples, VtValue(8)});
+    _settingDescriptors.push_back({"Denoiser cadence factor",
+        HdLuxCoreRenderSettingsTokens->denoiserCadence, VtValue(2.0f)});
+
+    // Render thread placement, applied when the render session starts.
+    // The affinity mask is a CPU list such as "0-15,32-47"; NUMA_COMPACT
+    // keeps the threads on as few NUMA nodes as they fit on, so they don't
+    // compete for memory bandwidth across sockets. With an automatic
+    // thread count, NUMA_COMPACT renders on the first node, with one
+    // thread per core of that node.
+    _settingDescriptors.push_back({"Render thread count (0 for automatic)",
+        HdLuxCoreRenderSettingsTokens->renderThreadCount, VtValue(0)});
+    _settingDescriptors.push_back({"Cores reserved for the UI",
+        HdLuxCoreRenderSettingsTokens->reservedUICores, VtValue(0)});
+    _settingDescriptors.push_back({"Render thread CPU affinity mask",
+        HdLuxCoreRenderSettingsTokens->cpuAffinityMask, VtValue(std::string())});
+    _settingDescriptors.push_back({"Render thread pinning (NONE, NUMA_COMPACT: first node when the count is automatic)",
+        HdLuxCoreRenderSettingsTokens->threadPinning, VtValue(std::string("NONE"))});
+
+    // Background viewports that stop drawing stop rendering after this
+    // many seconds, and resume on their next draw. 0 disables it.
+    _settingDescriptors.push_back({"Idle timeout (seconds)",
+        HdLuxCoreRenderSettingsTokens->idleTimeout, VtValue(0.0f)});
+
+    // Deterministic mode renders the same image for the same scene, seed,
+    // sample count and thread count, for comparisons against golden
+    // images; the converged image can be written to a file.
+    _settingDescriptors.push_back({"Enable deterministic rendering",
+        HdLuxCoreRenderSettingsTokens->enableDeterministic, VtValue(false)});
+    _settingDescriptors.push_back({"Deterministic seed",
+        HdLuxCoreRenderSettingsTokens->deterministicSeed, VtValue(1)});
+    _settingDescriptors.push_back({"Deterministic samples per pixel",
+        HdLuxCoreRenderSettingsTokens->deterministicSamples, VtValue(64)});
+    _settingDescriptors.push_back({"Write the converged image to",
+        HdLuxCoreRenderSettingsTokens->filmOutputFile, VtValue(std::string())});
+    _PopulateDefaultSettings(_settingDescriptors);
+
+    // Create the session for the initial settings, so the first frame
+    // doesn't replace it
+    int renderThreadCount = 0;
+    std::vector<int> const renderThreadCpus = GetRenderThreadCpus(&renderThreadCount);
+    luxrays::Properties const configProps = GetRenderConfigProperties(renderThreadCount);
+    lc_config = luxcore::RenderConfig::Create(configProps, lc_scene);
+
+    luxcore::RenderSession *lc_session = luxcore::RenderSession::Create(lc_config);
 
     // Store top-level objects inside a render param that can be
     // passed to prims during Sync(). Also pass a handle to the render thread.
     _renderParam = std::make_shared<HdLuxCoreRenderParam>(
         lc_scene, lc_config, lc_session, &_sceneVersion);
+    _renderParam->SetRenderThreadCpus(renderThreadCpus);
+
+    // Persistent caches are named from the hash of the translated scene,
+    // which is empty here. With a cache directory set, the first frame
+    // creates the session again once the scene is translated.
+    if (GetRenderSetting<std::string>(
+            HdLuxCoreRenderSettingsTokens->persistentCacheDirectory,
+            std::string()).empty()) {
+        _renderParam->SetRenderConfigKey(
+            GetRenderConfigKey(configProps, renderThreadCpus));
+    }
 
     // Initialize one resource registry for all plugins
     std::lock_guard<std::mutex> guard(_mutexResourceRegistry);
 
     if (_counterResourceRegistry.fetch_add(1) == 0) {
         _resourceRegistry.reset( new HdResourceRegistry() );
+        HdLuxCoreStartTraceReport();
     }
 }
 
 HdLuxCoreRenderDelegate::~HdLuxCoreRenderDelegate()
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
+    bool lastDelegate = false;
     {
         std::lock_guard<std::mutex> guard(_mutexResourceRegistry);
         if (_counterResourceRegistry.fetch_sub(1) == 1) {
             _resourceRegistry.reset();
+            lastDelegate = true;
         }
     }
 
-    lc_session->Stop();
+    _renderParam->StopRendering();
 
     _renderParam.reset();
+
+    // The trace report covers the lifetime of all delegates
+    if (lastDelegate) {
+        HdLuxCoreWriteTraceReport();
+    }
 }
 
 HdRenderSettingDescriptorList
 HdLuxCoreRenderDelegate::GetRenderSettingDescriptors() const
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     return _settingDescriptors;
 }
@@ -187,7 +339,7 @@ HdLuxCoreRenderDelegate::GetRenderSettingDescriptors() const
 HdRenderParam*
 HdLuxCoreRenderDelegate::GetRenderParam() const
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     return _renderParam.get();
 }
@@ -195,13 +347,16 @@ HdLuxCoreRenderDelegate::GetRenderParam() const
 void
 HdLuxCoreRenderDelegate::CommitResources(HdChangeTracker *tracker)
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
+
+    HdLuxCoreRenderStats::ScopedPhase phase(
+        &_renderParam->GetStats(), HdLuxCoreRenderStats::PhaseCommit);
 }
 
 TfTokenVector const&
 HdLuxCoreRenderDelegate::GetSupportedRprimTypes() const
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     return SUPPORTED_RPRIM_TYPES;
 }
@@ -209,7 +364,7 @@ HdLuxCoreRenderDelegate::GetSupportedRprimTypes() const
 TfTokenVector const&
 HdLuxCoreRenderDelegate::GetSupportedSprimTypes() const
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     return SUPPORTED_SPRIM_TYPES;
 }
@@ -217,7 +372,7 @@ HdLuxCoreRenderDelegate::GetSupportedSprimTypes() const
 TfTokenVector const&
 HdLuxCoreRenderDelegate::GetSupportedBprimTypes() const
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     return SUPPORTED_BPRIM_TYPES;
 }
@@ -225,7 +380,7 @@ HdLuxCoreRenderDelegate::GetSupportedBprimTypes() const
 HdResourceRegistrySharedPtr
 HdLuxCoreRenderDelegate::GetResourceRegistry() const
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     return _resourceRegistry;
 }
@@ -233,7 +388,7 @@ HdLuxCoreRenderDelegate::GetResourceRegistry() const
 HdAovDescriptor
 HdLuxCoreRenderDelegate::GetDefaultAovDescriptor(TfToken const& name) const
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     if (name == HdAovTokens->color) {
         return HdAovDescriptor(HdFormatUNorm8Vec4, true,
@@ -260,11 +415,472 @@ HdLuxCoreRenderDelegate::GetDefaultAovDescriptor(TfToken const& name) const
     return HdAovDescriptor();
 }
 
+bool
+HdLuxCoreRenderDelegate::IsPauseSupported() const
+{
+    return true;
+}
+
+bool
+HdLuxCoreRenderDelegate::Pause()
+{
+    HDLUXCORE_TRACE_FUNCTION();
+
+    _renderParam->HoldRendering(HdLuxCoreRenderParam::HoldReasonUser);
+    return true;
+}
+
+bool
+HdLuxCoreRenderDelegate::Resume()
+{
+    HDLUXCORE_TRACE_FUNCTION();
+
+    _renderParam->ReleaseRendering(HdLuxCoreRenderParam::HoldReasonUser);
+    return true;
+}
+
+bool
+HdLuxCoreRenderDelegate::IsStopSupported() const
+{
+    return true;
+}
+
+bool
+HdLuxCoreRenderDelegate::Stop()
+{
+    HDLUXCORE_TRACE_FUNCTION();
+
+    _renderParam->StopRendering();
+    return true;
+}
+
+VtDictionary
+HdLuxCoreRenderDelegate::GetRenderStats() const
+{
+    HDLUXCORE_TRACE_FUNCTION();
+
+    VtDictionary stats;
+
+    // Render progress, from the running session
+    if (_renderParam->IsRendering()) {
+        luxcore::RenderSession *lc_session = _renderParam->_session;
+        lc_session->UpdateStats();
+        luxrays::Properties const& lc_stats = lc_session->GetStats();
+        auto const getStat = [&lc_stats](std::string const& name) {
+            return lc_stats.Get(luxrays::Property(name)(0.0)).Get<double>();
+        };
+
+        luxcore::Film &film = lc_session->GetFilm();
+        double const pixels = double(film.GetWidth()) * film.GetHeight();
+        double const samples = getStat("stats.renderengine.total.samplecount");
+        stats["samplesPerPixel"] = VtValue(pixels > 0.0 ? samples / pixels : 0.0);
+        stats["samplesPerSecond"] = VtValue(getStat("stats.renderengine.total.samplesec"));
+        stats["raysPerSecond"] = VtValue(getStat("stats.renderengine.total.raysec"));
+        stats["elapsedSeconds"] = VtValue(getStat("stats.renderengine.time"));
+        stats["triangleCount"] = VtValue(
+            static_cast<int64_t>(getStat("stats.dataset.trianglecount")));
+
+        // Device memory, for the engines that report it
+        luxrays::Property const devices =
+            lc_stats.Get(luxrays::Property("stats.renderengine.devices")());
+        for (unsigned int i = 0; i < devices.GetSize(); i++) {
+            std::string const device = devices.Get<std::string>(i);
+            stats["memory.device." + device + ".bytes"] = VtValue(
+                static_cast<int64_t>(getStat(
+                    "stats.renderengine.devices." + device + ".memory.used")));
+        }
+    }
+
+    _renderParam->GetStats().GetPhaseStats(&stats);
+    _renderParam->GetStats().GetLatencyStats(&stats);
+
+    // Scene counts and the memory of the translated scene
+    HdLuxCorePrimRegistry<HdLuxCoreMesh>::Snapshot const meshes =
+        _meshRegistry.GetSnapshot();
+    int64_t instanceCount = 0, meshBytes = 0;
+    for (HdLuxCoreMesh const *mesh : *meshes) {
+        instanceCount += mesh->GetInstancesRendered();
+        meshBytes += mesh->GetMemoryUsage();
+    }
+    stats["meshCount"] = VtValue(static_cast<int64_t>(meshes->size()));
+    stats["instanceCount"] = VtValue(instanceCount);
+    stats["lightCount"] = VtValue(
+        static_cast<int64_t>(_lightRegistry.GetSnapshot()->size()));
+    stats["memory.meshes.bytes"] = VtValue(meshBytes);
+    stats["memory.filmReadback.bytes"] = VtValue(
+        static_cast<int64_t>(_renderParam->GetStats().GetFilmReadbackBytes()));
+
+    return stats;
+}
+
+luxrays::Properties
+HdLuxCoreRenderDelegate::GetRenderConfigProperties(int renderThreadCount) const
+{
+    luxrays::Properties props;
+
+    // Render threads
+    props << luxrays::Property("native.threads.count")(renderThreadCount);
+
+    // Light strategy
+    std::string lightStrategy = GetRenderSetting<std::string>(
+        HdLuxCoreRenderSettingsTokens->lightStrategy, std::string("LOG_POWER"));
+    if (lightStrategy != "UNIFORM" && lightStrategy != "POWER" &&
+        lightStrategy != "LOG_POWER" && lightStrategy != "DLS_CACHE") {
+        TF_WARN("Unknown light strategy '%s', using LOG_POWER",
+                lightStrategy.c_str());
+        lightStrategy = "LOG_POWER";
+    }
+    props << luxrays::Property("lightstrategy.type")(lightStrategy);
+
+    // The ambient occlusion preview traces a single bounce towards a
+    // constant environment and halts after a fixed number of samples. The
+    // other modes use the path depth settings and never halt.
+    bool const preview = GetRenderSetting<bool>(
+        HdLuxCoreRenderSettingsTokens->enableAmbientOcclusion, false);
+    if (preview) {
+        props <<
+            luxrays::Property("path.pathdepth.total")(1) <<
+            luxrays::Property("path.pathdepth.diffuse")(1) <<
+            luxrays::Property("path.pathdepth.glossy")(1) <<
+            luxrays::Property("path.pathdepth.specular")(1) <<
+            luxrays::Property("batch.haltspp")(std::max(0, GetRenderSetting<int>(
+                HdLuxCoreRenderSettingsTokens->ambientOcclusionSamples, 16)));
+    } else {
+        props <<
+            luxrays::Property("path.pathdepth.total")(std::max(1, GetRenderSetting<int>(
+                HdLuxCoreRenderSettingsTokens->pathDepthTotal, 6))) <<
+            luxrays::Property("path.pathdepth.diffuse")(std::max(1, GetRenderSetting<int>(
+                HdLuxCoreRenderSettingsTokens->pathDepthDiffuse, 4))) <<
+            luxrays::Property("path.pathdepth.glossy")(std::max(1, GetRenderSetting<int>(
+                HdLuxCoreRenderSettingsTokens->pathDepthGlossy, 4))) <<
+            luxrays::Property("path.pathdepth.specular")(std::max(1, GetRenderSetting<int>(
+                HdLuxCoreRenderSettingsTokens->pathDepthSpecular, 6))) <<
+            luxrays::Property("batch.haltspp")(0);
+    }
+
+    props <<
+        luxrays::Property("path.clamping.variance.maxvalue")(std::max(0.0f, GetRenderSetting<float>(
+            HdLuxCoreRenderSettingsTokens->clampingVarianceMax, 0.0f))) <<
+        luxrays::Property("path.russianroulette.depth")(std::max(1, GetRenderSetting<int>(
+            HdLuxCoreRenderSettingsTokens->russianRouletteDepth, 3))) <<
+        luxrays::Property("path.russianroulette.cap")(GfClamp(GetRenderSetting<float>(
+            HdLuxCoreRenderSettingsTokens->russianRouletteCap, 0.5f), 0.0f, 1.0f));
+
+    // Deterministic mode renders tiles in a single pass, each seeded from
+    // the fixed seed and its position, so the image doesn't depend on how
+    // threads pick up work. The sample count is rounded to a square number
+    // of anti-aliasing samples.
+    bool const deterministic = GetRenderSetting<bool>(
+        HdLuxCoreRenderSettingsTokens->enableDeterministic, false);
+    if (deterministic) {
+        int const samples = std::max(1, GetRenderSetting<int>(
+            HdLuxCoreRenderSettingsTokens->deterministicSamples, 64));
+        int const aaSize = std::max(1, static_cast<int>(
+            std::lround(std::sqrt(static_cast<float>(samples)))));
+        props <<
+            luxrays::Property("renderengine.type")("TILEPATHCPU") <<
+            luxrays::Property("sampler.type")("TILEPATHSAMPLER") <<
+            luxrays::Property("renderengine.seed")(std::max(1, GetRenderSetting<int>(
+                HdLuxCoreRenderSettingsTokens->deterministicSeed, 1))) <<
+            luxrays::Property("tilepath.sampling.aa.size")(aaSize) <<
+            luxrays::Property("tile.multipass.enable")(false) <<
+            luxrays::Property("batch.haltspp")(aaSize * aaSize);
+    } else {
+        props <<
+            luxrays::Property("renderengine.type")("PATHCPU") <<
+            luxrays::Property("sampler.type")("RANDOM");
+    }
+
+    // PhotonGI caches, not used by the preview
+    bool const photonGI = !preview && GetRenderSetting<bool>(
+        HdLuxCoreRenderSettingsTokens->enablePhotonGI, false);
+    bool const indirect = photonGI && GetRenderSetting<bool>(
+        HdLuxCoreRenderSettingsTokens->photonGIIndirect, true);
+    bool const caustic = photonGI && GetRenderSetting<bool>(
+        HdLuxCoreRenderSettingsTokens->photonGICaustic, false);
+    props << luxrays::Property("path.photongi.indirect.enabled")(indirect) <<
+             luxrays::Property("path.photongi.caustic.enabled")(caustic);
+
+    if (indirect || caustic) {
+        float const radius = GetRenderSetting<float>(
+            HdLuxCoreRenderSettingsTokens->photonGILookupRadius, 0.15f);
+
+        luxrays::Properties photonGIProps;
+        photonGIProps <<
+            luxrays::Property("path.photongi.photon.maxcount")(
+                std::max(1, GetRenderSetting<int>(
+                    HdLuxCoreRenderSettingsTokens->photonGIMaxPhotonCount, 20000000))) <<
+            luxrays::Property("path.photongi.photon.maxdepth")(
+                std::max(1, GetRenderSetting<int>(
+                    HdLuxCoreRenderSettingsTokens->photonGIMaxDepth, 4))) <<
+            luxrays::Property("path.photongi.indirect.lookup.radius")(radius) <<
+            luxrays::Property("path.photongi.caustic.lookup.radius")(radius);
+        props << photonGIProps;
+    }
+
+    // Film channels can't be added to a running session
+    if (GetRenderSetting<bool>(HdLuxCoreRenderSettingsTokens->enableContourLines, false)) {
+        props <<
+            luxrays::Property("film.outputs.1.type")("IRRADIANCE") <<
+            luxrays::Property("film.outputs.1.filename")("irradiance.hdr");
+    }
+    if (GetRenderSetting<bool>(HdLuxCoreRenderSettingsTokens->enableDenoiser, false)) {
+        props <<
+            luxrays::Property("film.outputs.2.type")("ALBEDO") <<
+            luxrays::Property("film.outputs.2.filename")("albedo.exr") <<
+            luxrays::Property("film.outputs.3.type")("AVG_SHADING_NORMAL") <<
+            luxrays::Property("film.outputs.3.filename")("normal.exr");
+    }
+
+    return props;
+}
+
+std::vector<int>
+HdLuxCoreRenderDelegate::GetRenderThreadCpus(int *threadCount) const
+{
+    std::vector<int> const available = HdLuxCoreGetThreadCpus();
+    std::vector<int> cpus = available;
+
+    std::string const mask = GetRenderSetting<std::string>(
+        HdLuxCoreRenderSettingsTokens->cpuAffinityMask, std::string());
+    if (!mask.empty()) {
+        std::vector<int> maskCpus, allowed;
+        if (!HdLuxCoreParseCpuList(mask, &maskCpus)) {
+            TF_WARN("Invalid CPU affinity mask '%s', ignoring it", mask.c_str());
+        } else {
+            std::set_intersection(cpus.begin(), cpus.end(),
+                maskCpus.begin(), maskCpus.end(), std::back_inserter(allowed));
+            if (allowed.empty()) {
+                TF_WARN("CPU affinity mask '%s' contains no available CPU, "
+                        "ignoring it", mask.c_str());
+            } else {
+                cpus.swap(allowed);
+            }
+        }
+    }
+
+    // Render threads are kept off the first cores, which leaves them to
+    // the UI thread and the rest of the application
+    int const reserved = GetRenderSetting<int>(
+        HdLuxCoreRenderSettingsTokens->reservedUICores, 0);
+    if (reserved > 0 && !cpus.empty()) {
+        if (reserved >= static_cast<int>(cpus.size())) {
+            TF_WARN("Cannot reserve %d of %zu cores for the UI, rendering "
+                    "on one", reserved, cpus.size());
+        }
+        cpus.erase(cpus.begin(),
+            cpus.begin() + std::min(static_cast<size_t>(reserved), cpus.size() - 1));
+    }
+
+    int count = GetRenderSetting<int>(
+        HdLuxCoreRenderSettingsTokens->renderThreadCount, 0);
+
+    // Take whole NUMA nodes, in order, until they have a core per thread.
+    // Without an explicit thread count, that is the first node with an
+    // available core, and the count is its core count; otherwise the
+    // default count would cover every node. LuxCore's threads can't be
+    // pinned individually, but on Linux they inherit the affinity of the
+    // thread that starts them.
+    std::string const pinning = GetRenderSetting<std::string>(
+        HdLuxCoreRenderSettingsTokens->threadPinning, std::string("NONE"));
+    if (pinning == "NUMA_COMPACT") {
+        std::vector<int> compact;
+        for (std::vector<int> const& node : HdLuxCoreGetNumaNodes()) {
+            if (!compact.empty() &&
+                (count <= 0 || static_cast<int>(compact.size()) >= count)) {
+                break;
+            }
+            std::set_intersection(node.begin(), node.end(),
+                cpus.begin(), cpus.end(), std::back_inserter(compact));
+        }
+        if (!compact.empty()) {
+            std::sort(compact.begin(), compact.end());
+            cpus.swap(compact);
+            if (count <= 0) {
+                count = static_cast<int>(cpus.size());
+            }
+        }
+    } else if (pinning != "NONE") {
+        TF_WARN("Unknown thread pinning '%s', using NONE", pinning.c_str());
+    }
+
+    // By default, never start more render threads than there are cores for
+    // them, nor than Hydra's sync may use
+    if (count <= 0) {
+        count = std::min(static_cast<int>(WorkGetConcurrencyLimit()),
+                         static_cast<int>(cpus.size()));
+    }
+
+    if (threadCount) {
+        *threadCount = std::max(count, 1);
+    }
+
+    // Leave the affinity alone when nothing restricts it
+    return cpus == available ? std::vector<int>() : cpus;
+}
+
+luxrays::Properties
+HdLuxCoreRenderDelegate::GetPersistentCacheProperties(luxrays::Properties const& configProps,
+                                                      uint64_t sceneHash) const
+{
+    luxrays::Properties props;
+
+    std::string const cacheDirectory = GetRenderSetting<std::string>(
+        HdLuxCoreRenderSettingsTokens->persistentCacheDirectory, std::string());
+
+    // The direct light sampling cache is reloaded from disk when the scene
+    // is unchanged, which skips building it on session start. The file name
+    // is keyed on the scene hash, and UpdateRenderSession() renames it when
+    // an edit changes the hash, so a stale cache is never loaded. An empty
+    // name clears a file set for a previous session.
+    std::string const lightStrategy = GetRenderSetting<std::string>(
+        HdLuxCoreRenderSettingsTokens->lightStrategy, std::string("LOG_POWER"));
+    props << luxrays::Property("lightstrategy.persistent.file")(
+        lightStrategy == "DLS_CACHE" ?
+            HdLuxCoreRenderParam::GetPersistentCacheFile(cacheDirectory, "dlsc", sceneHash) :
+            std::string());
+
+    // LuxCore loads a persistent PhotonGI cache without checking the
+    // settings it was built with, so they are part of the file name along
+    // with the scene hash. Like the DLS cache, it is renamed when an edit
+    // changes the scene hash.
+    bool const indirect = configProps.Get(luxrays::Property(
+        "path.photongi.indirect.enabled")(false)).Get<bool>();
+    bool const caustic = configProps.Get(luxrays::Property(
+        "path.photongi.caustic.enabled")(false)).Get<bool>();
+    std::string photonGIFile;
+    if (indirect || caustic) {
+        std::string const key =
+            configProps.GetAllProperties("path.photongi.").ToString();
+        photonGIFile = HdLuxCoreRenderParam::GetPersistentCacheFile(
+            cacheDirectory, "pgi", ArchHash64(key.c_str(), key.size(), sceneHash));
+    }
+    props << luxrays::Property("path.photongi.persistent.file")(photonGIFile);
+
+    return props;
+}
+
+void
+HdLuxCoreRenderDelegate::UpdateRenderSession(luxrays::Properties const& configProps,
+                                             std::string const& key)
+{
+    HDLUXCORE_TRACE_FUNCTION();
+
+    uint64_t const sceneHash = _renderParam->GetSceneHash();
+    luxrays::Properties const cacheProps =
+        GetPersistentCacheProperties(configProps, sceneHash);
+    _renderParam->UpdateRenderConfig(
+        luxrays::Properties(configProps) << cacheProps, key);
+
+    // A PhotonGI cache built before a geometry or material edit gives a
+    // wrong image, not only slower sampling, so both files are tracked
+    if (!cacheProps.Get("lightstrategy.persistent.file").Get<std::string>().empty() ||
+        !cacheProps.Get("path.photongi.persistent.file").Get<std::string>().empty()) {
+        _renderParam->SetPersistentCacheScene(configProps, sceneHash);
+    } else {
+        _renderParam->ClearPersistentCacheScene();
+    }
+}
+
+std::string
+HdLuxCoreRenderDelegate::GetRenderConfigKey(luxrays::Properties const& configProps,
+                                            std::vector<int> const& renderThreadCpus) const
+{
+    return configProps.ToString() +
+        "cpus = " + HdLuxCoreFormatCpuList(renderThreadCpus) + "\n" +
+        "cache = " + GetRenderSetting<std::string>(
+            HdLuxCoreRenderSettingsTokens->persistentCacheDirectory, std::string());
+}
+
+luxrays::Properties
+HdLuxCoreRenderDelegate::GetImagePipelineProperties() const
+{
+    std::string tonemapper = GetRenderSetting<std::string>(
+        HdLuxCoreRenderSettingsTokens->tonemapper, std::string("AUTOLINEAR"));
+    if (tonemapper != "AUTOLINEAR" && tonemapper != "LINEAR" &&
+        tonemapper != "REINHARD02") {
+        TF_WARN("Unknown tonemapper '%s', using AUTOLINEAR", tonemapper.c_str());
+        tonemapper = "AUTOLINEAR";
+    }
+
+    // Pipeline 0 is read back every frame. The denoised pipeline 1 is only
+    // executed at the render pass' denoising cadence.
+    luxrays::Properties props;
+    _AddImagePipeline(0, tonemapper, false, &props);
+    if (GetRenderSetting<bool>(HdLuxCoreRenderSettingsTokens->enableDenoiser, false)) {
+        _AddImagePipeline(1, tonemapper, true, &props);
+    }
+
+    return props;
+}
+
+void
+HdLuxCoreRenderDelegate::_AddImagePipeline(int index,
+                                           std::string const& tonemapper,
+                                           bool denoise,
+                                           luxrays::Properties *props) const
+{
+    int plugin = 0;
+    auto pluginPrefix = [index, &plugin]() {
+        return "film.imagepipelines." + std::to_string(index) + "." +
+            std::to_string(plugin) + ".";
+    };
+
+    // The denoiser works on the linear radiance, before tonemapping. It
+    // reads the ALBEDO and AVG_SHADING_NORMAL film channels added by
+    // GetRenderConfigProperties().
+    if (denoise) {
+        *props << luxrays::Property(pluginPrefix() + "type")("INTEL_OIDN");
+        plugin++;
+    }
+
+    // Exposure is a linear scale, applied after the auto-linear tonemapper
+    // normalizes the film and before the others
+    float const exposure = powf(2.0f, GetRenderSetting<float>(
+        HdLuxCoreRenderSettingsTokens->exposure, 0.0f));
+    if (tonemapper == "AUTOLINEAR") {
+        *props << luxrays::Property(pluginPrefix() + "type")("TONEMAP_AUTOLINEAR");
+        plugin++;
+    }
+    if (tonemapper == "LINEAR" || exposure != 1.0f) {
+        *props <<
+            luxrays::Property(pluginPrefix() + "type")("TONEMAP_LINEAR") <<
+            luxrays::Property(pluginPrefix() + "scale")(exposure);
+        plugin++;
+    }
+    if (tonemapper == "REINHARD02") {
+        *props << luxrays::Property(pluginPrefix() + "type")("TONEMAP_REINHARD02");
+        plugin++;
+    }
+
+    // Contour lines of the irradiance, for lighting studies. The IRRADIANCE
+    // film channel they read is added by GetRenderConfigProperties().
+    if (GetRenderSetting<bool>(HdLuxCoreRenderSettingsTokens->enableContourLines, false)) {
+        *props <<
+            luxrays::Property(pluginPrefix() + "type")("CONTOUR_LINES") <<
+            luxrays::Property(pluginPrefix() + "scale")(GetRenderSetting<float>(
+                HdLuxCoreRenderSettingsTokens->contourLinesScale, 179.0f)) <<
+            luxrays::Property(pluginPrefix() + "range")(GetRenderSetting<float>(
+                HdLuxCoreRenderSettingsTokens->contourLinesRange, 100.0f)) <<
+            luxrays::Property(pluginPrefix() + "steps")(std::max(1, GetRenderSetting<int>(
+                HdLuxCoreRenderSettingsTokens->contourLinesSteps, 8)));
+        plugin++;
+    }
+
+    *props <<
+        luxrays::Property(pluginPrefix() + "type")("GAMMA_CORRECTION") <<
+        luxrays::Property(pluginPrefix() + "value")(GetRenderSetting<float>(
+            HdLuxCoreRenderSettingsTokens->gamma, 2.2f));
+
+    // Light color and intensity edits made with light groups enabled
+    _renderParam->AddRadianceScaleProperties(index, props);
+}
+
 HdRenderPassSharedPtr
 HdLuxCoreRenderDelegate::CreateRenderPass(HdRenderIndex *index,
                             HdRprimCollection const& collection)
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     return HdRenderPassSharedPtr(new HdLuxCoreRenderPass(
         index, collection, &_sceneVersion));
@@ -275,7 +891,7 @@ HdLuxCoreRenderDelegate::CreateInstancer(HdSceneDelegate *delegate,
                                         SdfPath const& id,
                                         SdfPath const& instancerId)
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     return new HdLuxCoreInstancer(delegate, id, instancerId);
 }
@@ -283,7 +899,7 @@ HdLuxCoreRenderDelegate::CreateInstancer(HdSceneDelegate *delegate,
 void
 HdLuxCoreRenderDelegate::DestroyInstancer(HdInstancer *instancer)
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     delete instancer;
 }
@@ -293,11 +909,11 @@ HdLuxCoreRenderDelegate::CreateRprim(TfToken const& typeId,
                                     SdfPath const& rprimId,
                                     SdfPath const& instancerId)
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     if (typeId == HdPrimTypeTokens->mesh) {
         HdLuxCoreMesh *mesh = new HdLuxCoreMesh(rprimId, instancerId);
-        _rprimMap[rprimId.GetString()] = mesh;
+        _meshRegistry.Insert(rprimId, mesh);
         return mesh;
     } else {
         TF_CODING_ERROR("Unknown Rprim Type %s", typeId.GetText());
@@ -309,7 +925,10 @@ HdLuxCoreRenderDelegate::CreateRprim(TfToken const& typeId,
 void
 HdLuxCoreRenderDelegate::DestroyRprim(HdRprim *rPrim)
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
+
+    // The mesh's LuxCore objects are already removed by Finalize()
+    _meshRegistry.Remove(rPrim->GetId());
 
     delete rPrim;
 }
@@ -318,15 +937,15 @@ HdSprim *
 HdLuxCoreRenderDelegate::CreateSprim(TfToken const& typeId,
                                     SdfPath const& sprimId)
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     if (typeId == HdPrimTypeTokens->camera) {
         return new HdLuxCoreCamera(sprimId);
     } else if (typeId == HdPrimTypeTokens->extComputation) {
         return new HdExtComputation(sprimId);
-    } else if (typeId == HdPrimTypeTokens->sphereLight) {
+    } else if (_IsLightType(typeId)) {
         HdLuxCoreLight *light = new HdLuxCoreLight(sprimId, typeId);
-        _sprimLightMap[sprimId.GetString()] = light;
+        _lightRegistry.Insert(sprimId, light);
         return light;
     } else {
         TF_CODING_ERROR("Unknown Sprim Type %s", typeId.GetText());
@@ -338,7 +957,7 @@ HdLuxCoreRenderDelegate::CreateSprim(TfToken const& typeId,
 HdSprim *
 HdLuxCoreRenderDelegate::CreateFallbackSprim(TfToken const& typeId)
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     // For fallback sprims, create objects with an empty scene path.
     // They'll use default values and won't be updated by a scene delegate.
@@ -346,7 +965,7 @@ HdLuxCoreRenderDelegate::CreateFallbackSprim(TfToken const& typeId)
         return new HdCamera(SdfPath::EmptyPath());
     } else if (typeId == HdPrimTypeTokens->extComputation) {
         return new HdExtComputation(SdfPath::EmptyPath());
-    } else if (typeId == HdPrimTypeTokens->sphereLight) {
+    } else if (_IsLightType(typeId)) {
         return new HdLuxCoreLight(SdfPath::EmptyPath(), typeId);
     } else {
         TF_CODING_ERROR("Unknown Sprim Type %s", typeId.GetText());
@@ -358,7 +977,10 @@ HdLuxCoreRenderDelegate::CreateFallbackSprim(TfToken const& typeId)
 void
 HdLuxCoreRenderDelegate::DestroySprim(HdSprim *sPrim)
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
+
+    // Lights are already removed from the LuxCore scene by Finalize()
+    _lightRegistry.Remove(sPrim->GetId());
 
     delete sPrim;
 }
@@ -367,7 +989,7 @@ HdBprim *
 HdLuxCoreRenderDelegate::CreateBprim(TfToken const& typeId,
                                     SdfPath const& bprimId)
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     return nullptr;
 }
@@ -375,7 +997,7 @@ HdLuxCoreRenderDelegate::CreateBprim(TfToken const& typeId,
 HdBprim *
 HdLuxCoreRenderDelegate::CreateFallbackBprim(TfToken const& typeId)
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     return nullptr;
 }
@@ -383,7 +1005,7 @@ HdLuxCoreRenderDelegate::CreateFallbackBprim(TfToken const& typeId)
 void
 HdLuxCoreRenderDelegate::DestroyBprim(HdBprim *bPrim)
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     delete bPrim;
 }
@@ -27,11 +27,14 @@
 #include "pxr/pxr.h"
 #include "pxr/imaging/hd/renderDelegate.h"
 #include "pxr/base/tf/staticTokens.h"
+#include "pxr/base/vt/dictionary.h"
 #include "pxr/imaging/hdLuxCore/mesh.h"
 #include "pxr/imaging/hdLuxCore/light.h"
+#include "pxr/imaging/hdLuxCore/primRegistry.h"
 
 #include <luxcore/luxcore.h>
 #include <mutex>
+#include <vector>
 
 
 #ifdef __linux__
@@ -50,8 +53,6 @@ namespace __gnu_cxx
 
 #endif
 
-int logit(std::string message);
-
 PXR_NAMESPACE_OPEN_SCOPE
 
 class HdLuxCoreRenderParam;
@@ -59,7 +60,45 @@ class HdLuxCoreRenderParam;
 #define HDLUXCORE_RENDER_SETTINGS_TOKENS \
     (enableAmbientOcclusion)            \
     (enableSceneColors)                 \
-    (ambientOcclusionSamples)
+    (ambientOcclusionSamples)           \
+    (enableInstanceLod)                 \
+    (instanceLodPixelThreshold)         \
+    (instanceLodHysteresis)             \
+    (lightStrategy)                     \
+    (persistentCacheDirectory)          \
+    (enablePhotonGI)                    \
+    (photonGIIndirect)                  \
+    (photonGICaustic)                   \
+    (photonGIMaxPhotonCount)            \
+    (photonGIMaxDepth)                  \
+    (photonGILookupRadius)              \
+    (enableLightGroups)                 \
+    (tonemapper)                        \
+    (exposure)                          \
+    (gamma)                             \
+    (enableContourLines)                \
+    (contourLinesScale)                 \
+    (contourLinesRange)                 \
+    (contourLinesSteps)                 \
+    (pathDepthTotal)                    \
+    (pathDepthDiffuse)                  \
+    (pathDepthGlossy)                   \
+    (pathDepthSpecular)                 \
+    (clampingVarianceMax)               \
+    (russianRouletteDepth)              \
+    (russianRouletteCap)                \
+    (enableDenoiser)                    \
+    (denoiserStartSamples)              \
+    (denoiserCadence)                   \
+    (renderThreadCount)                 \
+    (reservedUICores)                   \
+    (cpuAffinityMask)                   \
+    (threadPinning)                     \
+    (idleTimeout)                       \
+    (enableDeterministic)               \
+    (deterministicSeed)                 \
+    (deterministicSamples)              \
+    (filmOutputFile)
 
 // Also: HdRenderSettingsTokens->convergedSamplesPerPixel
 
@@ -248,11 +287,94 @@ public:
     virtual HdAovDescriptor
         GetDefaultAovDescriptor(TfToken const& name) const override;
 
-    // A map of rprims
-    TfHashMap<std::string, HdLuxCoreMesh*> _rprimMap;
-    // A map of sprim Lights
-    TfHashMap<std::string, HdLuxCoreLight*> _sprimLightMap;
+    /// Return true, LuxCore's render threads can be paused.
+    virtual bool IsPauseSupported() const override;
+
+    /// Pause the render threads until Resume(), for example while the
+    /// viewport is hidden. Scene edits are still applied.
+    ///   \return True if successful.
+    virtual bool Pause() override;
+
+    /// Resume the render threads after Pause().
+    ///   \return True if successful.
+    virtual bool Resume() override;
+
+    /// Return render progress from LuxCore, the timings of the phases of
+    /// getting edits to LuxCore, scene counts and memory use by subsystem.
+    virtual VtDictionary GetRenderStats() const override;
+
+    // HdRenderDelegate has no stop API in USD 19.07, so the following
+    // aren't overrides; they are only reachable through this class.
+
+    /// Return true, the render session can be stopped.
+    bool IsStopSupported() const;
+
+    /// Stop the render threads. The last image stays displayed, and the
+    /// session restarts on the next scene, camera or settings change.
+    ///   \return True if successful.
+    bool Stop();
+
+    /// Translate the current render settings into LuxCore render
+    /// configuration properties. Changing any of them requires a new render
+    /// session, see HdLuxCoreRenderParam::UpdateRenderConfig().
+    ///   \param renderThreadCount The thread count from
+    ///                            GetRenderThreadCpus().
+    ///   \return The render configuration properties.
+    luxrays::Properties GetRenderConfigProperties(int renderThreadCount) const;
+
+    /// Return the persistent cache file properties of a render session
+    /// created now with \p configProps, for the scene with hash
+    /// \p sceneHash. Files are disabled when no cache directory is set.
+    /// They aren't part of the render configuration key; a scene edit
+    /// recreates a session using them, see UpdateRenderSession().
+    ///   \param configProps The GetRenderConfigProperties() result.
+    ///   \param sceneHash The current HdLuxCoreRenderParam::GetSceneHash().
+    ///   \return The persistent cache file properties.
+    luxrays::Properties GetPersistentCacheProperties(
+        luxrays::Properties const& configProps, uint64_t sceneHash) const;
+
+    /// Return a key identifying the render session that \p configProps
+    /// and the other session-wide settings need; the session is recreated
+    /// when it changes.
+    ///   \param configProps The GetRenderConfigProperties() result.
+    ///   \param renderThreadCpus The GetRenderThreadCpus() result.
+    ///   \return The render configuration key.
+    std::string GetRenderConfigKey(luxrays::Properties const& configProps,
+                                   std::vector<int> const& renderThreadCpus) const;
+
+    /// Recreate the render session with \p configProps and persistent
+    /// cache files named for the current scene. Scene edits recreate a
+    /// session loading cache files the same way once the scene hash
+    /// changes, rather than reload caches built for the previous scene.
+    ///   \param configProps The GetRenderConfigProperties() result.
+    ///   \param key The GetRenderConfigKey() result.
+    void UpdateRenderSession(luxrays::Properties const& configProps,
+                             std::string const& key);
+
+    /// Return the definition of the film's image pipelines. These only
+    /// post-process the film, so they can be replaced through
+    /// RenderSession::Parse() without restarting the render.
+    ///   \return The film.imagepipelines properties.
+    luxrays::Properties GetImagePipelineProperties() const;
+
+    /// Return the CPUs render threads are restricted to, from the affinity
+    /// mask, reserved UI cores and thread pinning settings. Applied when
+    /// the render session starts and whenever LuxCore recreates its render
+    /// threads, see HdLuxCoreRenderParam::SetRenderThreadCpus().
+    ///   \param threadCount If not null, set to the number of render threads.
+    ///   \return The CPUs, or an empty list if threads may run on any CPU.
+    std::vector<int> GetRenderThreadCpus(int *threadCount = nullptr) const;
+
+    // The meshes and lights created by this delegate, for the render pass
+    HdLuxCorePrimRegistry<HdLuxCoreMesh> _meshRegistry;
+    HdLuxCorePrimRegistry<HdLuxCoreLight> _lightRegistry;
+
 private:
+    // Append the definition of image pipeline \p index to \p props,
+    // optionally starting with the denoiser.
+    void _AddImagePipeline(int index, std::string const& tonemapper,
+                           bool denoise, luxrays::Properties *props) const;
+
     static const TfTokenVector SUPPORTED_RPRIM_TYPES;
     static const TfTokenVector SUPPORTED_SPRIM_TYPES;
     static const TfTokenVector SUPPORTED_BPRIM_TYPES;
@@ -270,8 +392,9 @@ private:
     void _Initialize();
     luxrays::Properties lc_props;
     luxcore::RenderConfig *lc_config;
-    luxcore::RenderSession *lc_session;
     luxcore::Scene *lc_scene;
+    // The render session is owned by _renderParam, since render setting
+    // changes may replace it.
     // A version counter for edits to _scene.
     std::atomic<int> _sceneVersion;
 
@@ -282,8 +405,8 @@ private:
     // A list of render setting exports.
     HdRenderSettingDescriptorList _settingDescriptors;
 
-    // A callback that interprets LuxCore error codes and injects them into
-    // the hydra logging system.
+    // LuxCore's log handler, which forwards LuxCore's log to the HdLuxCore
+    // log sink, rate limited. See trace.h.
     static void HandleLuxCoreError(const char *msg);
 };
 
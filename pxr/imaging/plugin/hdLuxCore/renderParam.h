@@ -27,9 +27,25 @@
 #include "pxr/pxr.h"
 #include "pxr/imaging/hd/renderDelegate.h"
 #include "pxr/imaging/hd/renderThread.h"
+#include "pxr/imaging/hdLuxCore/renderStats.h"
+#include "pxr/imaging/hdLuxCore/threadAffinity.h"
+#include "pxr/base/gf/vec3f.h"
+#include "pxr/base/tf/stringUtils.h"
 
 #include <luxcore/luxcore.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
 using namespace luxcore;
 
 #include <iostream>
@@ -53,7 +69,16 @@ public:
         : _scene(scene), _config(config), _session(session), _sceneVersion(sceneVersion)
         {}
 
-    virtual ~HdLuxCoreRenderParam() = default;
+    virtual ~HdLuxCoreRenderParam() {
+        if (_idleWatchdog.joinable()) {
+            {
+                std::lock_guard<std::mutex> guard(_idleMutex);
+                _idleWatchdogStop = true;
+            }
+            _idleWakeup.notify_one();
+            _idleWatchdog.join();
+        }
+    }
 
     /// Accessor for the top-level LuxCore scene.
     Scene* AcquireSceneForEdit() {
@@ -61,12 +86,528 @@ public:
         return _scene;
     }
 
+    /// Record that a prim has changes to write to the LuxCore scene; the
+    /// render pass only opens a scene edit when the version moved.
+    void MarkSceneDirty() {
+        (*_sceneVersion)++;
+    }
+
+    /// Apply \p props to the render configuration and restart the render
+    /// session. This is required for any setting outside of the scene and
+    /// the film, such as the light strategy or the engine's caches; the
+    /// scene, camera and film size are preserved. The session is replaced
+    /// under the same lock as PauseRendering(), so Hydra's worker threads
+    /// and the idle timeout never see it half replaced.
+    ///   \param props The render configuration properties.
+    ///   \param key The key of the new configuration, see
+    ///              HdLuxCoreRenderDelegate::GetRenderConfigKey().
+    void UpdateRenderConfig(luxrays::Properties const& props,
+                            std::string const& key) {
+        std::lock_guard<std::mutex> guard(_sessionMutex);
+        bool const started = _started.load();
+        _StopRenderingLocked();
+        delete _session;
+        _config->Parse(props);
+        _session = RenderSession::Create(_config);
+        _renderConfigKey = key;
+        if (started) {
+            _StartRenderingLocked();
+        }
+    }
+
+    /// Return the key of the render configuration the session was created
+    /// with, see HdLuxCoreRenderDelegate::GetRenderConfigKey(). It is empty
+    /// until a configuration is recorded.
+    std::string const& GetRenderConfigKey() const {
+        return _renderConfigKey;
+    }
+
+    /// Record the key of the render configuration the session was created
+    /// with.
+    void SetRenderConfigKey(std::string const& key) {
+        _renderConfigKey = key;
+    }
+
+    /// Record that the session loads persistent cache files named for the
+    /// scene with hash \p sceneHash, chosen from the render configuration
+    /// properties \p configProps.
+    void SetPersistentCacheScene(luxrays::Properties const& configProps,
+                                 uint64_t sceneHash) {
+        _persistentCacheConfig = configProps;
+        _persistentCacheSceneHash = sceneHash;
+        _persistentCacheEnabled = true;
+    }
+
+    /// Record that the session loads no persistent cache file.
+    void ClearPersistentCacheScene() {
+        _persistentCacheConfig = luxrays::Properties();
+        _persistentCacheEnabled = false;
+    }
+
+    /// Return true if the session's persistent cache files were named for
+    /// a scene other than the current one. LuxCore would load caches built
+    /// before the last edits, so the session must be recreated with files
+    /// for the current scene.
+    bool IsPersistentCacheStale() const {
+        return _persistentCacheEnabled &&
+            _persistentCacheSceneHash != GetSceneHash();
+    }
+
+    /// Return the render configuration properties the session's persistent
+    /// cache files were chosen from.
+    luxrays::Properties const& GetPersistentCacheConfig() const {
+        return _persistentCacheConfig;
+    }
+
+    /// Open an edit of _scene. Must be paired with EndSceneEdit().
+    /// A session loading persistent caches is stopped rather than edited,
+    /// since LuxCore reloads the cache files when an edit ends.
+    void BeginSceneEdit() {
+        _sceneEditStopped = _persistentCacheEnabled;
+        if (_sceneEditStopped) {
+            StopRendering();
+        } else {
+            _session->BeginSceneEdit();
+        }
+    }
+
+    /// Close an edit opened by BeginSceneEdit(). A stopped session is
+    /// started again if its persistent caches are still valid; otherwise
+    /// it stays stopped and the scene is marked dirty, so the render pass
+    /// recreates it with caches for the edited scene.
+    ///
+    /// LuxCore's CPU engines replace their render threads when an edit
+    /// ends, so the new threads get the affinity set by
+    /// SetRenderThreadCpus() like those of StartRendering().
+    void EndSceneEdit() {
+        if (!_sceneEditStopped) {
+            HdLuxCoreScopedThreadAffinity affinity(_GetRenderThreadCpus());
+            _session->EndSceneEdit();
+        } else if (IsPersistentCacheStale()) {
+            MarkSceneDirty();
+        } else {
+            StartRendering();
+        }
+    }
+
+    /// Set the CPUs render threads are restricted to from the next
+    /// StartRendering(), EndSceneEdit() or ResumeRendering() on. An empty
+    /// list lets them run on any CPU.
+    void SetRenderThreadCpus(std::vector<int> const& cpus) {
+        std::lock_guard<std::mutex> guard(_sessionMutex);
+        _renderThreadCpus = cpus;
+    }
+
+    /// Start the render session's threads, if they aren't running. On
+    /// Linux they inherit the affinity set by SetRenderThreadCpus().
+    void StartRendering() {
+        std::lock_guard<std::mutex> guard(_sessionMutex);
+        _StartRenderingLocked();
+    }
+
+    /// Return true if the render session's threads are started, paused or
+    /// not.
+    bool IsRendering() const {
+        return _started.load();
+    }
+
+    /// Stop the render session's threads, if they are running.
+    void StopRendering() {
+        std::lock_guard<std::mutex> guard(_sessionMutex);
+        _StopRenderingLocked();
+    }
+
+    /// Pause the render threads, so that Hydra's sync, OpenSubdiv
+    /// refinement and scene edits get the cores. Prims call this from
+    /// Sync() when they have changes; it is cheap once paused and may be
+    /// called from any thread.
+    void PauseRendering() {
+        if (_paused.load() || !_started.load()) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> guard(_sessionMutex);
+        if (_started.load() && !_paused.load()) {
+            _session->Pause();
+            _paused.store(true);
+        }
+    }
+
+    /// Resume render threads paused by PauseRendering(). The render pass
+    /// calls this once all edits of a frame are applied. Rendering stays
+    /// paused while held by HoldRendering().
+    void ResumeRendering() {
+        std::lock_guard<std::mutex> guard(_sessionMutex);
+        if (_paused.load() && !_holds.load()) {
+            HdLuxCoreScopedThreadAffinity affinity(_renderThreadCpus);
+            _session->Resume();
+            _paused.store(false);
+        }
+    }
+
+    /// Return the phase timings reported by GetRenderStats().
+    HdLuxCoreRenderStats &GetStats() {
+        return _stats;
+    }
+
+    /// Reasons for holding the render threads paused.
+    enum HoldReason {
+        HoldReasonUser = 1 << 0,    // HdRenderDelegate::Pause()
+        HoldReasonIdle = 1 << 1     // The idle timeout expired
+    };
+
+    /// Pause the render threads and keep them paused, across frames and
+    /// session restarts, until every reason is released.
+    void HoldRendering(HoldReason reason) {
+        _holds.fetch_or(reason);
+        PauseRendering();
+    }
+
+    /// Release a reason for holding the render threads, resuming them if
+    /// it was the last one.
+    void ReleaseRendering(HoldReason reason) {
+        if ((_holds.fetch_and(~reason) & ~reason) == 0) {
+            ResumeRendering();
+        }
+    }
+
+    /// Pause rendering when the render pass hasn't executed for \p seconds,
+    /// for example while its viewport is hidden. 0 disables the timeout.
+    void SetIdleTimeout(float seconds) {
+        {
+            std::lock_guard<std::mutex> guard(_idleMutex);
+            _idleTimeout = std::chrono::duration<float>(std::max(seconds, 0.0f));
+            if (seconds > 0.0f && !_idleWatchdog.joinable()) {
+                _lastExecute = std::chrono::steady_clock::now();
+                _idleWatchdog = std::thread(&HdLuxCoreRenderParam::_RunIdleWatchdog, this);
+            }
+        }
+        _idleWakeup.notify_one();
+    }
+
+    /// Record that the render pass executes, restarting the idle timeout.
+    /// An expired timeout is released; the render pass resumes rendering
+    /// once the frame's edits are applied.
+    void NotifyExecute() {
+        bool wasIdle = false;
+        {
+            std::lock_guard<std::mutex> guard(_idleMutex);
+            _lastExecute = std::chrono::steady_clock::now();
+            wasIdle = _holds.fetch_and(~HoldReasonIdle) & HoldReasonIdle;
+        }
+        if (wasIdle) {
+            _idleWakeup.notify_one();
+        }
+    }
+
+    /// Record the content hash of a translated prim under \p key,
+    /// replacing any previous hash for that key.
+    void SetContentHash(std::string const& key, uint64_t hash) {
+        std::lock_guard<std::mutex> guard(_hashMutex);
+        auto it = _contentHashes.find(key);
+        if (it != _contentHashes.end()) {
+            _sceneHash -= it->second;
+            it->second = hash;
+        } else {
+            _contentHashes.emplace(key, hash);
+        }
+        _sceneHash += hash;
+    }
+
+    /// Forget the content hash recorded under \p key.
+    void RemoveContentHash(std::string const& key) {
+        std::lock_guard<std::mutex> guard(_hashMutex);
+        auto it = _contentHashes.find(key);
+        if (it != _contentHashes.end()) {
+            _sceneHash -= it->second;
+            _contentHashes.erase(it);
+        }
+    }
+
+    /// Return a hash of all translated geometry, lights and materials,
+    /// used to key persistent render caches. It doesn't depend on the order
+    /// prims were translated in.
+    uint64_t GetSceneHash() const {
+        std::lock_guard<std::mutex> guard(_hashMutex);
+        return _sceneHash;
+    }
+
+    /// Return the path of the persistent cache file of type \p kind for
+    /// content with the given hash, or an empty string if \p directory is
+    /// empty, which disables persistent caches.
+    static std::string GetPersistentCacheFile(std::string const& directory,
+                                              std::string const& kind,
+                                              uint64_t hash) {
+        if (directory.empty()) {
+            return std::string();
+        }
+
+        return TfStringCatPaths(directory,
+            TfStringPrintf("hdLuxCore_%s_%016llx.cache", kind.c_str(),
+                           (unsigned long long)hash));
+    }
+
+    /// The placeholder light LuxCore requires in order to initialize the
+    /// renderer when the USD scene has no lights.
+    static luxrays::Properties GetDefaultLightProperties() {
+        return luxrays::Properties() <<
+            luxrays::Property("scene.lights.light_default.type")("point") <<
+            luxrays::Property("scene.lights.light_default.color")(1.0, 1.0, 1.0) <<
+            luxrays::Property("scene.lights.light_default.gain")(1.0, 1.0, 1.0) <<
+            luxrays::Property("scene.lights.light_default.direction")(1.0, 1.0, 1.0) <<
+            luxrays::Property("scene.lights.light_default.position")(1.0, 1.0, 1.0);
+    }
+
+    /// Define or delete the placeholder light that LuxCore requires when
+    /// the scene has no lights of its own. Must be called between
+    /// BeginSceneEdit() and EndSceneEdit().
+    void SetDefaultLightEnabled(bool enabled) {
+        if (enabled == _defaultLightEnabled) {
+            return;
+        }
+
+        if (enabled) {
+            _scene->Parse(GetDefaultLightProperties());
+        } else {
+            _scene->DeleteLight("light_default");
+        }
+        _defaultLightEnabled = enabled;
+    }
+
+    /// Enable or disable the ambient occlusion preview mode. The render
+    /// pass sets this from the render settings before a scene edit; lights
+    /// are removed from the scene while it is enabled.
+    void SetPreviewMode(bool enabled) {
+        _previewMode = enabled;
+    }
+
+    /// Return true if the scene is shaded for a fast ambient occlusion
+    /// preview instead of with its own lights.
+    bool GetPreviewMode() const {
+        return _previewMode;
+    }
+
+    /// Define or delete the constant environment that lights the scene in
+    /// preview mode. Must be called between BeginSceneEdit() and
+    /// EndSceneEdit().
+    void SetPreviewEnvironmentEnabled(bool enabled) {
+        if (enabled == _previewEnvironmentEnabled) {
+            return;
+        }
+
+        if (enabled) {
+            _scene->Parse(
+                luxrays::Property("scene.lights.light_preview.type")("constantinfinite") <<
+                luxrays::Property("scene.lights.light_preview.color")(1.0f, 1.0f, 1.0f) <<
+                luxrays::Property("scene.lights.light_preview.gain")(1.0f, 1.0f, 1.0f));
+        } else {
+            _scene->DeleteLight("light_preview");
+        }
+        _previewEnvironmentEnabled = enabled;
+    }
+
+    /// Enable or disable shading meshes with their displayColor.
+    void SetSceneColorsEnabled(bool enabled) {
+        _sceneColorsEnabled = enabled;
+    }
+
+    /// Return true if meshes are shaded with their displayColor.
+    bool GetSceneColorsEnabled() const {
+        return _sceneColorsEnabled;
+    }
+
+    /// The number of radiance groups available to lights, besides the
+    /// shared group 0. Each group is a full resolution film buffer.
+    static const int MaxLightGroups = 8;
+
+    /// Enable or disable per-light radiance groups. The render pass sets
+    /// this from the render settings before updating lights.
+    void SetLightGroupsEnabled(bool enabled) {
+        _lightGroupsEnabled = enabled;
+    }
+
+    /// Return true if lights are assigned radiance groups of their own.
+    bool GetLightGroupsEnabled() const {
+        return _lightGroupsEnabled;
+    }
+
+    /// Return the radiance group of \p light, assigning a free one if it
+    /// has none. Returns the shared group 0 when all groups are taken.
+    int AcquireLightGroup(std::string const& light) {
+        std::lock_guard<std::mutex> guard(_lightGroupMutex);
+        auto it = _lightGroups.find(light);
+        if (it != _lightGroups.end()) {
+            return it->second;
+        }
+
+        for (int group = 1; group <= MaxLightGroups; group++) {
+            bool taken = false;
+            for (auto const& entry : _lightGroups) {
+                taken = taken || entry.second == group;
+            }
+            if (!taken) {
+                _lightGroups.emplace(light, group);
+                return group;
+            }
+        }
+
+        return 0;
+    }
+
+    /// Release the radiance group of \p light and reset its scale.
+    void ReleaseLightGroup(std::string const& light) {
+        std::lock_guard<std::mutex> guard(_lightGroupMutex);
+        auto it = _lightGroups.find(light);
+        if (it != _lightGroups.end()) {
+            _SetLightGroupScale(it->second, GfVec3f(1.0f));
+            _lightGroups.erase(it);
+        }
+    }
+
+    /// Scale the radiance of a light group in the image pipelines. This
+    /// doesn't touch the scene, so accumulated samples are kept.
+    void SetLightGroupScale(int group, GfVec3f const& scale) {
+        std::lock_guard<std::mutex> guard(_lightGroupMutex);
+        _SetLightGroupScale(group, scale);
+    }
+
+    /// Append the radiance group scales to the definition of image
+    /// pipeline \p index.
+    void AddRadianceScaleProperties(int index, luxrays::Properties *props) const {
+        std::lock_guard<std::mutex> guard(_lightGroupMutex);
+        std::string const prefix =
+            "film.imagepipelines." + std::to_string(index) + ".radiancescales.";
+        for (auto const& entry : _lightGroupScales) {
+            GfVec3f const& scale = entry.second;
+            *props << luxrays::Property(prefix + std::to_string(entry.first) + ".rgbscale")(
+                scale[0], scale[1], scale[2]);
+        }
+    }
+
+    /// A version counter for changes to the image pipeline definitions
+    /// that don't come from render settings.
+    int GetImagePipelineVersion() const {
+        return _imagePipelineVersion.load();
+    }
+
     /// A handle to the top-level LuxCore scene.
     Scene *_scene;
     RenderConfig *_config;
     RenderSession *_session;
     /// A version counter for edits to _scene.
     std::atomic<int> *_sceneVersion;
+
+private:
+    // StartRendering() and StopRendering() for callers holding
+    // _sessionMutex.
+    void _StartRenderingLocked() {
+        if (!_started.load()) {
+            HdLuxCoreScopedThreadAffinity affinity(_renderThreadCpus);
+            HdLuxCoreRenderStats::ScopedPhase phase(
+                &_stats, HdLuxCoreRenderStats::PhaseAcceleratorBuild);
+            _session->Start();
+            _started.store(true);
+            _paused.store(false);
+
+            // A restarted session stays paused while held
+            if (_holds.load()) {
+                _session->Pause();
+                _paused.store(true);
+            }
+        }
+    }
+
+    void _StopRenderingLocked() {
+        if (_started.load()) {
+            _session->Stop();
+            _started.store(false);
+            _paused.store(false);
+        }
+    }
+
+    std::vector<int> _GetRenderThreadCpus() {
+        std::lock_guard<std::mutex> guard(_sessionMutex);
+        return _renderThreadCpus;
+    }
+
+    // Hold the render threads once the idle timeout expires, until the
+    // render pass executes again. The check and the hold happen under
+    // _idleMutex, so NotifyExecute() can't slip in between.
+    void _RunIdleWatchdog() {
+        std::unique_lock<std::mutex> lock(_idleMutex);
+        while (!_idleWatchdogStop) {
+            if (_idleTimeout.count() <= 0.0f || (_holds.load() & HoldReasonIdle)) {
+                _idleWakeup.wait(lock);
+                continue;
+            }
+
+            auto const deadline = _lastExecute +
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(_idleTimeout);
+            if (std::chrono::steady_clock::now() < deadline) {
+                _idleWakeup.wait_until(lock, deadline);
+            } else {
+                HoldRendering(HoldReasonIdle);
+            }
+        }
+    }
+
+    HdLuxCoreRenderStats _stats;
+
+    // State of _session's render threads, see PauseRendering().
+    std::mutex _sessionMutex;
+    std::atomic<bool> _started{false};
+    std::atomic<bool> _paused{false};
+    std::atomic<int> _holds{0};
+
+    // The idle timeout, see SetIdleTimeout()
+    std::mutex _idleMutex;
+    std::condition_variable _idleWakeup;
+    std::chrono::duration<float> _idleTimeout{0.0f};
+    std::chrono::steady_clock::time_point _lastExecute;
+    bool _idleWatchdogStop = false;
+    std::thread _idleWatchdog;
+    std::vector<int> _renderThreadCpus;
+
+    // Content hashes of translated prims and their order-independent sum.
+    mutable std::mutex _hashMutex;
+    std::unordered_map<std::string, uint64_t> _contentHashes;
+    uint64_t _sceneHash = 0;
+
+    // Key of the render configuration the session was created with
+    std::string _renderConfigKey;
+
+    // The scene the session's persistent cache files were named for, see
+    // SetPersistentCacheScene()
+    luxrays::Properties _persistentCacheConfig;
+    uint64_t _persistentCacheSceneHash = 0;
+    bool _persistentCacheEnabled = false;
+    bool _sceneEditStopped = false;
+
+    void _SetLightGroupScale(int group, GfVec3f const& scale) {
+        if (scale == GfVec3f(1.0f)) {
+            _lightGroupScales.erase(group);
+        } else {
+            _lightGroupScales[group] = scale;
+        }
+        _imagePipelineVersion++;
+    }
+
+    // Radiance groups assigned to lights, by light path, and the scales
+    // that differ from 1.
+    mutable std::mutex _lightGroupMutex;
+    std::unordered_map<std::string, int> _lightGroups;
+    std::map<int, GfVec3f> _lightGroupScales;
+    std::atomic<int> _imagePipelineVersion{0};
+    bool _lightGroupsEnabled = false;
+
+    // Preview shading state
+    bool _previewMode = false;
+    bool _previewEnvironmentEnabled = false;
+    bool _sceneColorsEnabled = false;
+
+    // Whether light_default is currently defined in _scene; the render
+    // delegate defines it before the first render.
+    bool _defaultLightEnabled = true;
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
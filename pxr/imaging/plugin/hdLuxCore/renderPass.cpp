@@ -25,9 +25,14 @@
 
 #include "pxr/imaging/hd/renderPassState.h"
 #include "pxr/imaging/hdLuxCore/renderDelegate.h"
+#include "pxr/imaging/hdLuxCore/trace.h"
 #include "pxr/imaging/hdLuxCore/renderPass.h"
 #include "pxr/imaging/hdLuxCore/renderParam.h"
+#include "pxr/imaging/hdLuxCore/renderStats.h"
 
+#include <algorithm>
+#include <chrono>
+#include <exception>
 #include <iostream>
 using namespace std;
 
@@ -40,6 +45,7 @@ HdLuxCoreRenderPass::HdLuxCoreRenderPass(HdRenderIndex *index,
     , _sceneVersion(sceneVersion)
     , _lastSceneVersion(0)
     , _lastSettingsVersion(0)
+    , _lastImagePipelineVersion(-1)
     , _width(0)
     , _height(0)
     , _viewMatrix(1.0f) // == identity
@@ -47,55 +53,94 @@ HdLuxCoreRenderPass::HdLuxCoreRenderPass(HdRenderIndex *index,
     , _aovBindings()
     , _converged(false)
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 }
 
 HdLuxCoreRenderPass::~HdLuxCoreRenderPass()
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 }
 
 bool
 HdLuxCoreRenderPass::IsConverged() const
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     return _converged;
 }
 
+// Return the number of samples accumulated by the render session.
+static double
+_GetSampleCount(RenderSession *lc_session)
+{
+    lc_session->UpdateStats();
+    return lc_session->GetStats().Get(
+        "stats.renderengine.total.samplecount").Get<double>();
+}
+
 void
 HdLuxCoreRenderPass::_Execute(HdRenderPassStateSharedPtr const& renderPassState,
                              TfTokenVector const &renderTags)
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     HdRenderDelegate *renderDelegate = GetRenderIndex()->GetRenderDelegate();
     HdLuxCoreRenderDelegate *renderDelegateLux = reinterpret_cast<HdLuxCoreRenderDelegate*>(renderDelegate);
     HdRenderParam *renderParam = renderDelegate->GetRenderParam();
-    Scene *lc_scene = reinterpret_cast<HdLuxCoreRenderParam*>(renderParam)->_scene;
+    HdLuxCoreRenderParam *lc_renderParam = reinterpret_cast<HdLuxCoreRenderParam*>(renderParam);
+    Scene *lc_scene = lc_renderParam->_scene;
 
     // Retrieve the LuxCore render session
-    RenderSession *lc_session = reinterpret_cast<HdLuxCoreRenderParam*>(renderParam)->_session;
+    RenderSession *lc_session = lc_renderParam->_session;
+
+    // Rendering was paused if the viewport went idle; it resumes below
+    lc_renderParam->NotifyExecute();
+
+    // Edits are timed from the first prim Sync() until the first readback
+    // with samples of the edited scene. Edits arriving before then are
+    // folded into the pending measurement.
+    HdLuxCoreRenderStats &stats = lc_renderParam->GetStats();
+    std::chrono::steady_clock::time_point editTime;
+    if (stats.TakeEdit(&editTime) && !_editPending) {
+        _editTime = editTime;
+        _editPending = true;
+    }
 
     // Set the width and height to match the current viewport
     GfVec4f viewport = renderPassState->GetViewport();
     if (_width != viewport[2] || _height != viewport[3]) {
         _width = viewport[2];
         _height = viewport[3];
-        lc_session->Pause();
-        lc_session->Parse(
+        luxrays::Properties const filmSize =
             luxrays::Property("film.width")(_width) <<
-            luxrays::Property("film.height")(_height)
-        );
-        lc_session->Resume();
+            luxrays::Property("film.height")(_height);
+        _ResetDenoiser(lc_session);
+        lc_renderParam->PauseRendering();
+        lc_session->Parse(filmSize);
+
+        // Keep the configuration in step so a restarted session keeps the
+        // viewport size
+        lc_renderParam->_config->Parse(filmSize);
     }
 
     GfMatrix4d current_inverseViewMatrix = renderPassState->GetWorldToViewMatrix().GetInverse();
     GfMatrix4d current_inverseProjectionMatrix = renderPassState->GetProjectionMatrix().GetInverse();
 
+    int const settingsVersion = renderDelegate->GetRenderSettingsVersion();
+    bool const settingsChanged = settingsVersion != _lastSettingsVersion;
+    _lastSettingsVersion = settingsVersion;
+
+    bool const cameraChanged =
+        current_inverseViewMatrix != _inverseViewMatrix ||
+        current_inverseProjectionMatrix != _inverseProjectionMatrix;
+
     // Has the view or projection matrix changed?  Reset the camera if so.
-    if (current_inverseViewMatrix != _inverseViewMatrix || current_inverseProjectionMatrix != _inverseProjectionMatrix) {
+    if (cameraChanged) {
         _converged = false;
+        if (!_editPending) {
+            _editTime = std::chrono::steady_clock::now();
+            _editPending = true;
+        }
         _inverseViewMatrix = current_inverseViewMatrix;
         _inverseProjectionMatrix = current_inverseProjectionMatrix;
 
@@ -115,7 +160,8 @@ HdLuxCoreRenderPass::_Execute(HdRenderPassStateSharedPtr const& renderPassState,
         origin = _inverseViewMatrix.Transform(origin);
 
         // Stopping the session allows the camera to be reset
-        lc_session->Stop();
+        _ResetDenoiser(lc_session);
+        lc_renderParam->StopRendering();
         lc_scene->Parse(luxrays::Properties() <<
             luxrays::Property("scene.camera.type")("perspective") <<
             luxrays::Property("scene.camera.lookat.orig")(origin[0], origin[1], origin[2]) <<
@@ -123,102 +169,295 @@ HdLuxCoreRenderPass::_Execute(HdRenderPassStateSharedPtr const& renderPassState,
             luxrays::Property("scene.camera.up")(up[0], up[1], up[2]) <<
             luxrays::Property("scene.camera.fieldofview")(fieldOfView)
             );
-        lc_session->Start();
-    }
-
-    lc_session->Pause();
-    lc_session->BeginSceneEdit();
-
-    // Create the LuxCore Mesh Prototype
-    TfHashMap<std::string, HdLuxCoreMesh*> meshMap = renderDelegateLux->_rprimMap;
-    TfHashMap<std::string, HdLuxCoreMesh*>::iterator iter;
-
-    // Instantiate LuxCore mesh instances
-    for (iter = meshMap.begin(); iter != meshMap.end(); ++iter) {
-        HdLuxCoreMesh *mesh = iter->second;
-		TfMatrix4dVector transforms = mesh->GetTransforms();;
-
-		if (!lc_scene->IsMeshDefined(mesh->GetId().GetString())) {
-			mesh->CreateLuxCoreTriangleMesh(renderParam);
-		}
-
-		if (mesh->IsVisible() && mesh->GetInstancesRendered() != transforms.size()) {
-			// We can assume that there will always be one transform per mesh prototype
-			for (size_t i = 0; i < transforms.size(); i++)
-			{
-				GfMatrix4d *t = transforms[i];
-				GfMatrix4f m = GfMatrix4f(*t);
-
-				std::string instanceName = mesh->GetId().GetString() + std::to_string(i);
-				lc_scene->Parse(
-					luxrays::Property("scene.objects." + instanceName + ".shape")(mesh->GetId().GetString()) <<
-					luxrays::Property("scene.objects." + instanceName + ".material")("mat_default")
-				);
-				lc_scene->UpdateObjectTransformation(instanceName, m.GetArray());
-			}
-			mesh->SetInstancesRendered(transforms.size());
-		}
-		else {
-			if (!mesh->IsVisible() && mesh->GetInstancesRendered() > 0) {
-				// We can assume that there will always be one transform per mesh prototype
-				for (size_t i = 0; i < transforms.size(); i++)
-				{
-					GfMatrix4d *t = transforms[i];
-					GfMatrix4f m = GfMatrix4f(*t);
-
-					std::string instanceName = mesh->GetId().GetString() + std::to_string(i);
-					// Work around a bug in LuxCore -- remove the previous transformation so
-					// it doesn't get re-added if/when the object is re-instanced
-					lc_scene->UpdateObjectTransformation(instanceName, m.GetInverse().GetArray());
-					lc_scene->DeleteObject(instanceName);
-				}
-				mesh->SetInstancesRendered(0);
-			}
-		}
-    }
-
-    // Render any lighting
-    TfHashMap<std::string, HdLuxCoreLight*> lightMap = renderDelegateLux->_sprimLightMap;
-    TfHashMap<std::string, HdLuxCoreLight*>::iterator l_iter;
-    std::string light_type;
-
-    // If we already have lighting, remove the default light
-    if (lightMap.size() > 0) {
-        lc_scene->DeleteLight("light_default");
-    }
-
-    for (l_iter = lightMap.begin(); l_iter != lightMap.end(); ++l_iter) {
-        HdLuxCoreLight *light = l_iter->second;
-        if (!light->GetCreated()) {
-            light->SetCreated(true);
-            GfMatrix4d transform = light->GetLightTransform();
-            std::string light_id = light->GetId().GetString();
-            GfVec3f color = light->GetColor();
-            if (light->GetTreatAsPoint())
-                light_type = "point";
-            else
-                light_type = "sphere";
-            lc_scene->Parse(
-                luxrays::Property("scene.lights." + light_id + ".type")(light_type) <<
-                luxrays::Property("scene.lights." + light_id + ".color")(color[0], color[1], color[2]) <<
-                luxrays::Property("scene.lights." + light_id + ".position")(transform[3][0], transform[3][1], transform[3][2])
-            );
+        lc_renderParam->StartRendering();
+    }
+
+    // Only settings that change how prims are translated need a scene edit;
+    // render configuration and image pipeline settings are applied below
+    bool sceneSettingsChanged = false;
+    if (settingsChanged) {
+        bool const lodEnabled = renderDelegate->GetRenderSetting<bool>(
+            HdLuxCoreRenderSettingsTokens->enableInstanceLod, false);
+        float const lodPixelThreshold = renderDelegate->GetRenderSetting<float>(
+            HdLuxCoreRenderSettingsTokens->instanceLodPixelThreshold, 32.0f);
+        float const lodHysteresis = renderDelegate->GetRenderSetting<float>(
+            HdLuxCoreRenderSettingsTokens->instanceLodHysteresis, 0.25f);
+        bool const lightGroups = renderDelegate->GetRenderSetting<bool>(
+            HdLuxCoreRenderSettingsTokens->enableLightGroups, false);
+        bool const preview = renderDelegate->GetRenderSetting<bool>(
+            HdLuxCoreRenderSettingsTokens->enableAmbientOcclusion, false);
+        bool const sceneColors = renderDelegate->GetRenderSetting<bool>(
+            HdLuxCoreRenderSettingsTokens->enableSceneColors, false);
+
+        sceneSettingsChanged =
+            lodEnabled != _lodContext.enabled ||
+            lodPixelThreshold != _lodContext.pixelThreshold ||
+            lodHysteresis != _lodContext.hysteresis ||
+            lightGroups != lc_renderParam->GetLightGroupsEnabled() ||
+            preview != lc_renderParam->GetPreviewMode() ||
+            sceneColors != lc_renderParam->GetSceneColorsEnabled();
+
+        _lodContext.enabled = lodEnabled;
+        _lodContext.pixelThreshold = lodPixelThreshold;
+        _lodContext.hysteresis = lodHysteresis;
+
+        // With light groups, lights get a radiance group of their own and
+        // color or intensity edits only rescale it in the image pipeline
+        lc_renderParam->SetLightGroupsEnabled(lightGroups);
+
+        // The ambient occlusion preview replaces the scene's lights with a
+        // constant environment
+        lc_renderParam->SetPreviewMode(preview);
+        lc_renderParam->SetSceneColorsEnabled(sceneColors);
+
+        _denoiserEnabled = renderDelegate->GetRenderSetting<bool>(
+            HdLuxCoreRenderSettingsTokens->enableDenoiser, false);
+        _denoiserStartSamples = std::max(1, renderDelegate->GetRenderSetting<int>(
+            HdLuxCoreRenderSettingsTokens->denoiserStartSamples, 8));
+        _denoiserCadence = std::max(1.1f, renderDelegate->GetRenderSetting<float>(
+            HdLuxCoreRenderSettingsTokens->denoiserCadence, 2.0f));
+
+        lc_renderParam->SetIdleTimeout(renderDelegate->GetRenderSetting<float>(
+            HdLuxCoreRenderSettingsTokens->idleTimeout, 0.0f));
+
+        _filmOutputFile = renderDelegate->GetRenderSetting<std::string>(
+            HdLuxCoreRenderSettingsTokens->filmOutputFile, std::string());
+    }
+
+    // Instances are re-binned to a level of detail whenever the view or the
+    // LOD settings change.
+    if (cameraChanged || sceneSettingsChanged) {
+        double projectionMatrix[4][4];
+        renderPassState->GetProjectionMatrix().Get(projectionMatrix);
+
+        _lodContext.cameraPosition = _inverseViewMatrix.Transform(GfVec3d(0, 0, 0));
+        _lodContext.pixelScale = projectionMatrix[1][1] * _height * 0.5;
+        _lodContext.version++;
+    }
+
+    // Only open a scene edit when a prim changed since the last one, or when
+    // instances may need re-binning to a new level of detail
+    int const sceneVersion = _sceneVersion->load();
+    bool const sceneEdit = sceneVersion != _lastSceneVersion ||
+        sceneSettingsChanged || (cameraChanged && _lodContext.enabled);
+    if (sceneEdit) {
+        _lastSceneVersion = sceneVersion;
+        _converged = false;
+
+        _ResetDenoiser(lc_session);
+        lc_renderParam->PauseRendering();
+        auto const sceneEditStart = std::chrono::steady_clock::now();
+        lc_renderParam->BeginSceneEdit();
+
+        // Create the LuxCore Mesh Prototype
+        HdLuxCorePrimRegistry<HdLuxCoreMesh>::Snapshot const meshes =
+            renderDelegateLux->_meshRegistry.GetSnapshot();
+
+        // Instantiate LuxCore mesh instances
+        for (HdLuxCoreMesh *mesh : *meshes) {
+            if (!lc_scene->IsMeshDefined(mesh->GetId().GetString())) {
+                mesh->CreateLuxCoreTriangleMesh(renderParam);
+            }
+
+            // Objects of hidden meshes stay resident; visibility changes only
+            // re-bind their material.
+            mesh->UpdateLuxCoreObjects(renderParam, &_lodContext);
+        }
+
+        // Write new and changed lights in place; unchanged lights are skipped
+        HdLuxCorePrimRegistry<HdLuxCoreLight>::Snapshot const lights =
+            renderDelegateLux->_lightRegistry.GetSnapshot();
+
+        for (HdLuxCoreLight *light : *lights) {
+            light->UpdateLuxCoreLight(renderParam);
+        }
+
+        // The default light is only needed while the scene has no lights
+        bool const preview = lc_renderParam->GetPreviewMode();
+        lc_renderParam->SetPreviewEnvironmentEnabled(preview);
+        lc_renderParam->SetDefaultLightEnabled(lights->empty() && !preview);
+        stats.AddPhaseTime(HdLuxCoreRenderStats::PhaseSceneEdit,
+                           std::chrono::steady_clock::now() - sceneEditStart);
+        if (_editPending) {
+            stats.AddLatency(HdLuxCoreRenderStats::LatencyTranslation,
+                             std::chrono::steady_clock::now() - _editTime);
+        }
+
+        // Persistent caches named for the scene before the edit would be
+        // reloaded, so the session is recreated with files for the edited
+        // scene instead
+        if (lc_renderParam->IsPersistentCacheStale()) {
+            renderDelegateLux->UpdateRenderSession(
+                lc_renderParam->GetPersistentCacheConfig(),
+                lc_renderParam->GetRenderConfigKey());
+            lc_session = lc_renderParam->_session;
+        }
+
+        // Ending the edit rebuilds the engine's data set and accelerator
+        {
+            HdLuxCoreRenderStats::ScopedPhase phase(
+                &stats, HdLuxCoreRenderStats::PhaseAcceleratorBuild);
+            lc_renderParam->EndSceneEdit();
+        }
+        if (_editPending) {
+            stats.AddLatency(HdLuxCoreRenderStats::LatencySceneEdit,
+                             std::chrono::steady_clock::now() - _editTime);
+        }
+    }
+
+    // Settings outside of the scene, including the render thread placement,
+    // need a new render session. The persistent cache files aren't part of
+    // the key; scene edits rename them above when the scene hash changes.
+    if (settingsChanged || lc_renderParam->GetRenderConfigKey().empty()) {
+        int renderThreadCount = 0;
+        std::vector<int> const renderThreadCpus =
+            renderDelegateLux->GetRenderThreadCpus(&renderThreadCount);
+        luxrays::Properties const configProps =
+            renderDelegateLux->GetRenderConfigProperties(renderThreadCount);
+        std::string const configKey =
+            renderDelegateLux->GetRenderConfigKey(configProps, renderThreadCpus);
+        if (configKey != lc_renderParam->GetRenderConfigKey()) {
+            _converged = false;
+            _ResetDenoiser(lc_session);
+            lc_renderParam->SetRenderThreadCpus(renderThreadCpus);
+            renderDelegateLux->UpdateRenderSession(configProps, configKey);
+            lc_session = lc_renderParam->_session;
         }
     }
 
-    lc_session->EndSceneEdit();
-    lc_session->Resume();
+    // Render threads were paused for this frame's sync and edits. A session
+    // stopped through HdLuxCoreRenderDelegate::Stop() restarts on the next edit.
+    if (!lc_renderParam->IsRendering() && (sceneEdit || settingsChanged)) {
+        lc_renderParam->StartRendering();
+    }
+    lc_renderParam->ResumeRendering();
+
+    // Image pipeline edits only post-process the film, so they keep the
+    // samples accumulated so far
+    int const imagePipelineVersion = lc_renderParam->GetImagePipelineVersion();
+    if (imagePipelineVersion != _lastImagePipelineVersion || settingsChanged) {
+        _lastImagePipelineVersion = imagePipelineVersion;
+
+        luxrays::Properties const pipelineProps =
+            renderDelegateLux->GetImagePipelineProperties();
+        std::string const pipelineString = pipelineProps.ToString();
+        if (pipelineString != _lastImagePipelineString) {
+            _lastImagePipelineString = pipelineString;
+            _ResetDenoiser(lc_session);
+
+            lc_session->Parse(pipelineProps);
+
+            // Keep a restarted session's pipelines in step. Parsing merges
+            // properties, so the previous definition is deleted first.
+            lc_renderParam->_config->Delete("film.imagepipelines");
+            lc_renderParam->_config->Parse(pipelineProps);
+        }
+    }
 
     // Determine if the scene has finished rendering
-    if (lc_session->HasDone())
-        _converged = true;
+    bool const done = lc_session->HasDone();
+
+    if (_denoiserEnabled) {
+        _UpdateDenoiser(lc_session, done);
+    }
+
+    // The final image is the denoised one, if the denoiser is enabled
+    bool const converged = done && (!_denoiserEnabled ||
+        (_denoisedFinal && _denoisedValid && !_denoiserRunning));
+
+    // Write each newly converged image, e.g. for golden image comparisons
+    if (converged && !_converged && !_filmOutputFile.empty()) {
+        try {
+            lc_session->GetFilm().SaveOutput(_filmOutputFile,
+                Film::OUTPUT_RGB_IMAGEPIPELINE,
+                luxrays::Properties() <<
+                    luxrays::Property("index")(_denoiserEnabled ? 1u : 0u));
+            HDLUXCORE_LOG(Info, "Wrote the converged image to %s",
+                          _filmOutputFile.c_str());
+        } catch (std::exception const& e) {
+            TF_WARN("Cannot write the converged image to %s: %s",
+                    _filmOutputFile.c_str(), e.what());
+        }
+    }
+    _converged = converged;
+
+    // Copy the LuxCore film render into a buffer. The film is not read
+    // while the denoiser runs on it; the previous image is shown instead.
+    size_t const bufferSize = size_t(_width) * _height * 3;
+    if (!_denoiserRunning) {
+        bool const editRendered = _editPending && _GetSampleCount(lc_session) > 0.0;
+        {
+            HdLuxCoreRenderStats::ScopedPhase phase(
+                &stats, HdLuxCoreRenderStats::PhaseFilmReadback);
+            _pixelBuffer.resize(bufferSize);
+            lc_session->GetFilm().GetOutput<float>(Film::OUTPUT_RGB_IMAGEPIPELINE, _pixelBuffer.data(), 0);
+        }
 
-    // Copy the LuxCore film render into a buffer
-    unique_ptr<float[]> pxl_buffer(new float[_width * _height * 3]);
-    lc_session->GetFilm().GetOutput<float>(Film::OUTPUT_RGB_IMAGEPIPELINE, pxl_buffer.get(), 0);
+        if (editRendered) {
+            std::chrono::steady_clock::duration const latency =
+                std::chrono::steady_clock::now() - _editTime;
+            stats.AddLatency(HdLuxCoreRenderStats::LatencyEditToPixel, latency);
+            _editPending = false;
+
+            double const ms =
+                std::chrono::duration<double, std::milli>(latency).count();
+            TRACE_COUNTER_VALUE("HdLuxCore edit to pixel latency (ms)", ms);
+            HDLUXCORE_LOG(Info, "Edit to pixel latency %.1f ms", ms);
+        }
+    }
 
     // Draw the buffer to the OpenGL viewport
-    glDrawPixels(_width, _height, GL_RGB, GL_FLOAT, &pxl_buffer[0]);
+    std::vector<float> const& buffer = _denoisedValid ? _denoisedBuffer : _pixelBuffer;
+    lc_renderParam->GetStats().SetFilmReadbackBytes(
+        (_pixelBuffer.capacity() + _denoisedBuffer.capacity()) * sizeof(float));
+    if (buffer.size() == bufferSize) {
+        glDrawPixels(_width, _height, GL_RGB, GL_FLOAT, buffer.data());
+    }
+}
+
+void
+HdLuxCoreRenderPass::_ResetDenoiser(RenderSession *lc_session)
+{
+    if (_denoiserRunning) {
+        lc_session->GetFilm().WaitAsyncExecuteImagePipeline();
+        _denoiserRunning = false;
+    }
+
+    _denoisedValid = false;
+    _denoisedFinal = false;
+    _lastDenoiseSamples = 0.0;
+    _nextDenoiseSamples = _denoiserStartSamples;
+}
+
+void
+HdLuxCoreRenderPass::_UpdateDenoiser(RenderSession *lc_session, bool done)
+{
+    Film &film = lc_session->GetFilm();
+
+    // Pick up the result of the background run
+    if (_denoiserRunning) {
+        if (!film.HasDoneAsyncExecuteImagePipeline()) {
+            return;
+        }
+
+        _denoiserRunning = false;
+        _denoisedBuffer.resize(size_t(_width) * _height * 3);
+        film.GetOutput<float>(Film::OUTPUT_RGB_IMAGEPIPELINE,
+                              _denoisedBuffer.data(), 1, false);
+        _denoisedValid = true;
+    }
+
+    // Denoise on a geometric sample count cadence, so each run costs about
+    // as much as a fixed fraction of the rendering since the previous one,
+    // and once more for the final image.
+    double const spp = _GetSampleCount(lc_session) / (double(_width) * _height);
+    if (spp >= _nextDenoiseSamples || (done && spp > _lastDenoiseSamples)) {
+        film.AsyncExecuteImagePipeline(1);
+        _denoiserRunning = true;
+        _denoisedFinal = done;
+        _lastDenoiseSamples = spp;
+        _nextDenoiseSamples = spp * _denoiserCadence;
+    }
 }
 
 PXR_NAMESPACE_CLOSE_SCOPE
@@ -31,8 +31,12 @@
 #include "pxr/imaging/hdx/compositor.h"
 
 #include "pxr/base/gf/matrix4d.h"
+#include "pxr/imaging/hdLuxCore/mesh.h"
 
 #include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
 
 PXR_NAMESPACE_OPEN_SCOPE
 
@@ -81,6 +85,14 @@ protected:
     virtual void _MarkCollectionDirty() override {}
 
 private:
+    // Wait for a background denoiser run and discard the denoised image.
+    // Called before the film is edited or reset.
+    void _ResetDenoiser(luxcore::RenderSession *lc_session);
+
+    // Collect a finished denoiser run and start the next one when the film
+    // has accumulated enough new samples.
+    void _UpdateDenoiser(luxcore::RenderSession *lc_session, bool done);
+
     // A reference to the global scene version.
     std::atomic<int> *_sceneVersion;
 
@@ -90,6 +102,11 @@ private:
     // The last settings version we rendered with.
     int _lastSettingsVersion;
 
+    // The image pipeline version and definition the film was last
+    // post-processed with, see HdLuxCoreRenderDelegate::GetImagePipelineProperties().
+    int _lastImagePipelineVersion;
+    std::string _lastImagePipelineString;
+
     // The width of the viewport we're rendering into.
     unsigned int _width;
     // The height of the viewport we're rendering into.
@@ -106,6 +123,32 @@ private:
     // The list of aov buffers this renderpass should write to.
     HdRenderPassAovBindingVector _aovBindings;
 
+    // Denoiser settings and the state of its background runs, in samples
+    // per pixel
+    bool _denoiserEnabled = false;
+    int _denoiserStartSamples = 8;
+    float _denoiserCadence = 2.0f;
+    bool _denoiserRunning = false;
+    bool _denoisedValid = false;
+    bool _denoisedFinal = false;
+    double _lastDenoiseSamples = 0.0;
+    double _nextDenoiseSamples = 0.0;
+
+    // Where each converged image is written, if anywhere
+    std::string _filmOutputFile;
+
+    // The last film and denoised images read back from LuxCore
+    std::vector<float> _pixelBuffer;
+    std::vector<float> _denoisedBuffer;
+
+    // The time of the first edit not yet displayed, see
+    // HdLuxCoreRenderStats::MarkEdit()
+    bool _editPending = false;
+    std::chrono::steady_clock::time_point _editTime;
+
+    // View-dependent state for instance level of detail selection.
+    HdLuxCoreLodContext _lodContext;
+
     // Were the color/depth buffer converged the last time we blitted them?
     bool _converged;
 
@@ -0,0 +1,215 @@
+#ifndef HDLUXCORE_RENDER_STATS_H
+#define HDLUXCORE_RENDER_STATS_H
+
+#include "pxr/pxr.h"
+#include "pxr/base/vt/dictionary.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+///
+/// \class HdLuxCoreRenderStats
+///
+/// Timings of the phases of getting a Hydra edit to LuxCore, accumulated by
+/// the prims, the render delegate and the render pass and reported by
+/// HdLuxCoreRenderDelegate::GetRenderStats(). Timings may be added from any
+/// thread; prims syncing in parallel each add their own time, so the sync
+/// total is CPU time rather than wall clock time.
+///
+/// It also keeps the latency distribution of edits: from the first Sync()
+/// of an edit through translation and EndSceneEdit() to the first film
+/// readback with samples of the edited scene.
+///
+class HdLuxCoreRenderStats {
+public:
+    enum Phase {
+        PhaseSync,              // HdRprim/HdSprim::Sync()
+        PhaseCommit,            // HdRenderDelegate::CommitResources()
+        PhaseSceneEdit,         // Writing prims into a LuxCore scene edit
+        PhaseAcceleratorBuild,  // EndSceneEdit() and session start
+        PhaseFilmReadback,      // Reading the film for display
+        PhaseCount
+    };
+
+    /// Return the name \p phase is reported under.
+    static const char *GetPhaseName(Phase phase) {
+        static const char *names[PhaseCount] = {
+            "sync", "commit", "sceneEdit", "acceleratorBuild", "filmReadback"
+        };
+        return names[phase];
+    }
+
+    /// Add a run of \p phase that took \p duration.
+    void AddPhaseTime(Phase phase, std::chrono::steady_clock::duration duration) {
+        int64_t const ns =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+        _phases[phase].count.fetch_add(1, std::memory_order_relaxed);
+        _phases[phase].totalNs.fetch_add(ns, std::memory_order_relaxed);
+        _phases[phase].lastNs.store(ns, std::memory_order_relaxed);
+    }
+
+    /// Add the run count, last and total time in seconds of every phase to
+    /// \p stats, as "phase.<name>.count", "phase.<name>.lastSeconds" and
+    /// "phase.<name>.totalSeconds".
+    void GetPhaseStats(VtDictionary *stats) const {
+        for (int i = 0; i < PhaseCount; i++) {
+            std::string const prefix =
+                std::string("phase.") + GetPhaseName(Phase(i)) + ".";
+            _PhaseTimes const& phase = _phases[i];
+            (*stats)[prefix + "count"] = VtValue(
+                static_cast<int64_t>(phase.count.load(std::memory_order_relaxed)));
+            (*stats)[prefix + "lastSeconds"] = VtValue(
+                phase.lastNs.load(std::memory_order_relaxed) * 1e-9);
+            (*stats)[prefix + "totalSeconds"] = VtValue(
+                phase.totalNs.load(std::memory_order_relaxed) * 1e-9);
+        }
+    }
+
+    enum Latency {
+        LatencyTranslation,     // Edit until written to the scene edit
+        LatencySceneEdit,       // Edit until EndSceneEdit() returned
+        LatencyEditToPixel,     // Edit until displayed with new samples
+        LatencyCount
+    };
+
+    /// Return the name \p latency is reported under.
+    static const char *GetLatencyName(Latency latency) {
+        static const char *names[LatencyCount] = {
+            "translation", "sceneEdit", "editToPixel"
+        };
+        return names[latency];
+    }
+
+    /// Record that a prim received an edit. Only the first edit since the
+    /// last TakeEdit() is kept, so an edit's latency covers all the edits
+    /// batched with it.
+    void MarkEdit() {
+        int64_t const now = _Now();
+        int64_t expected = 0;
+        if (_editNs.load(std::memory_order_relaxed) == 0) {
+            _editNs.compare_exchange_strong(expected, now);
+        }
+    }
+
+    /// Take the time of the first edit since the last call.
+    ///   \return False if no prim was edited.
+    bool TakeEdit(std::chrono::steady_clock::time_point *time) {
+        int64_t const ns = _editNs.exchange(0);
+        if (ns == 0) {
+            return false;
+        }
+        *time = std::chrono::steady_clock::time_point(
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::nanoseconds(ns)));
+        return true;
+    }
+
+    /// Add a \p latency measurement. The latest measurements are kept.
+    void AddLatency(Latency latency, std::chrono::steady_clock::duration duration) {
+        double const seconds = std::chrono::duration<double>(duration).count();
+        std::lock_guard<std::mutex> guard(_latencyMutex);
+        _LatencySamples &samples = _latencies[latency];
+        if (samples.seconds.size() < LatencySampleCount) {
+            samples.seconds.push_back(seconds);
+        } else {
+            samples.seconds[samples.count % LatencySampleCount] = seconds;
+        }
+        samples.count++;
+    }
+
+    /// Add the measurement count, median, 99th percentile and last value in
+    /// seconds of every latency to \p stats, as "latency.<name>.count",
+    /// "latency.<name>.p50Seconds", "latency.<name>.p99Seconds" and
+    /// "latency.<name>.lastSeconds".
+    void GetLatencyStats(VtDictionary *stats) const {
+        std::lock_guard<std::mutex> guard(_latencyMutex);
+        for (int i = 0; i < LatencyCount; i++) {
+            std::string const prefix =
+                std::string("latency.") + GetLatencyName(Latency(i)) + ".";
+            _LatencySamples const& samples = _latencies[i];
+            (*stats)[prefix + "count"] = VtValue(static_cast<int64_t>(samples.count));
+            if (samples.seconds.empty()) {
+                continue;
+            }
+
+            std::vector<double> sorted = samples.seconds;
+            std::sort(sorted.begin(), sorted.end());
+            auto const percentile = [&sorted](double p) {
+                return sorted[std::min(sorted.size() - 1,
+                                       static_cast<size_t>(p * sorted.size()))];
+            };
+            (*stats)[prefix + "p50Seconds"] = VtValue(percentile(0.50));
+            (*stats)[prefix + "p99Seconds"] = VtValue(percentile(0.99));
+            (*stats)[prefix + "lastSeconds"] = VtValue(
+                samples.seconds[(samples.count - 1) % LatencySampleCount]);
+        }
+    }
+
+    /// Record the size of the render pass' film readback buffers.
+    void SetFilmReadbackBytes(size_t bytes) {
+        _filmReadbackBytes.store(bytes, std::memory_order_relaxed);
+    }
+
+    size_t GetFilmReadbackBytes() const {
+        return _filmReadbackBytes.load(std::memory_order_relaxed);
+    }
+
+    ///
+    /// \class ScopedPhase
+    ///
+    /// Adds the time from construction to destruction to a phase.
+    ///
+    class ScopedPhase {
+    public:
+        ScopedPhase(HdLuxCoreRenderStats *stats, Phase phase)
+            : _stats(stats), _phase(phase),
+              _start(std::chrono::steady_clock::now()) {}
+
+        ~ScopedPhase() {
+            _stats->AddPhaseTime(_phase, std::chrono::steady_clock::now() - _start);
+        }
+
+    private:
+        HdLuxCoreRenderStats *_stats;
+        Phase _phase;
+        std::chrono::steady_clock::time_point _start;
+    };
+
+    /// The number of latest measurements percentiles are computed over.
+    static const size_t LatencySampleCount = 1024;
+
+private:
+    static int64_t _Now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    struct _LatencySamples {
+        std::vector<double> seconds;
+        size_t count = 0;
+    };
+
+    struct _PhaseTimes {
+        std::atomic<uint64_t> count{0};
+        std::atomic<int64_t> totalNs{0};
+        std::atomic<int64_t> lastNs{0};
+    };
+
+    _PhaseTimes _phases[PhaseCount];
+    std::atomic<size_t> _filmReadbackBytes{0};
+
+    std::atomic<int64_t> _editNs{0};
+    mutable std::mutex _latencyMutex;
+    _LatencySamples _latencies[LatencyCount];
+};
+
+PXR_NAMESPACE_CLOSE_SCOPE
+
+#endif // HDLUXCORE_RENDER_STATS_H
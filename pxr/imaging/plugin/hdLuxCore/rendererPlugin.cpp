@@ -23,6 +23,7 @@
 //
 
 #include "pxr/imaging/hdLuxCore/rendererPlugin.h"
+#include "pxr/imaging/hdLuxCore/trace.h"
 #include "pxr/imaging/hdx/rendererPluginRegistry.h"
 #include "pxr/imaging/hdLuxCore/renderDelegate.h"
 
@@ -41,7 +42,7 @@ TF_REGISTRY_FUNCTION(TfType)
 HdRenderDelegate*
 HdLuxCoreRendererPlugin::CreateRenderDelegate()
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     return new HdLuxCoreRenderDelegate();
 }
@@ -55,7 +56,7 @@ HdLuxCoreRendererPlugin::DeleteRenderDelegate(HdRenderDelegate *renderDelegate)
 bool 
 HdLuxCoreRendererPlugin::IsSupported() const
 {
-    logit(BOOST_CURRENT_FUNCTION);
+    HDLUXCORE_TRACE_FUNCTION();
 
     return true;
 }
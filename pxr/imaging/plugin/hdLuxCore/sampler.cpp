@@ -68,12 +68,47 @@ _InterpolateImpl(void* out, void** samples, float* weights,
     }
 }
 
+template<typename T>
+static void
+_InterpolateDispatch(void* out, void** samples, float* weights,
+                     size_t sampleCount, short numComponents)
+{
+    // Map the common vector and matrix arities onto the fixed-size blend,
+    // so the component loop has a compile-time trip count.
+    switch(numComponents) {
+        case 1:
+            HdLuxCoreInterpolateComponents<T, 1>(out,
+                samples, weights, sampleCount);
+            break;
+        case 2:
+            HdLuxCoreInterpolateComponents<T, 2>(out,
+                samples, weights, sampleCount);
+            break;
+        case 3:
+            HdLuxCoreInterpolateComponents<T, 3>(out,
+                samples, weights, sampleCount);
+            break;
+        case 4:
+            HdLuxCoreInterpolateComponents<T, 4>(out,
+                samples, weights, sampleCount);
+            break;
+        case 16:
+            HdLuxCoreInterpolateComponents<T, 16>(out,
+                samples, weights, sampleCount);
+            break;
+        default:
+            _InterpolateImpl<T>(out, samples, weights, sampleCount,
+                numComponents);
+            break;
+    }
+}
+
 /* static */ bool
 HdLuxCorePrimvarSampler::_Interpolate(void* out, void** samples, float* weights,
     size_t sampleCount, HdTupleType dataType)
 {
     // Combine maps from component type tag to C++ type, and delegates to
-    // the templated _InterpolateImpl.
+    // the templated _InterpolateDispatch.
 
     // Combine number of components in the underlying type and tuple arity.
     short numComponents = HdGetComponentCount(dataType.type) * dataType.count;
@@ -85,30 +120,31 @@ HdLuxCorePrimvarSampler::_Interpolate(void* out, void** samples, float* weights,
             /* This function isn't meaningful on boolean types. */
             return false;
         case HdTypeInt8:
-            _InterpolateImpl<char>(out, samples, weights, sampleCount,
+            _InterpolateDispatch<char>(out, samples, weights, sampleCount,
                 numComponents);
+            return true;
         case HdTypeInt16:
-            _InterpolateImpl<short>(out, samples, weights, sampleCount,
+            _InterpolateDispatch<short>(out, samples, weights, sampleCount,
                 numComponents);
             return true;
         case HdTypeUInt16:
-            _InterpolateImpl<unsigned short>(out, samples, weights, sampleCount,
-                numComponents);
+            _InterpolateDispatch<unsigned short>(out, samples, weights,
+                sampleCount, numComponents);
             return true;
         case HdTypeInt32:
-            _InterpolateImpl<int>(out, samples, weights, sampleCount,
+            _InterpolateDispatch<int>(out, samples, weights, sampleCount,
                 numComponents);
             return true;
         case HdTypeUInt32:
-            _InterpolateImpl<unsigned int>(out, samples, weights, sampleCount,
-                numComponents);
+            _InterpolateDispatch<unsigned int>(out, samples, weights,
+                sampleCount, numComponents);
             return true;
         case HdTypeFloat:
-            _InterpolateImpl<float>(out, samples, weights, sampleCount,
+            _InterpolateDispatch<float>(out, samples, weights, sampleCount,
                 numComponents);
             return true;
         case HdTypeDouble:
-            _InterpolateImpl<double>(out, samples, weights, sampleCount,
+            _InterpolateDispatch<double>(out, samples, weights, sampleCount,
                 numComponents);
             return true;
         default:
@@ -26,6 +26,7 @@
 
 #include "pxr/pxr.h"
 #include <cstddef>
+#include <cstring>
 
 #include "pxr/imaging/glf/glew.h"
 
@@ -43,6 +44,9 @@
 #include "pxr/base/gf/vec4d.h"
 #include "pxr/base/gf/vec4f.h"
 #include "pxr/base/gf/vec4i.h"
+#include "pxr/base/vt/array.h"
+#include "pxr/base/vt/value.h"
+#include "pxr/base/trace/trace.h"
 
 PXR_NAMESPACE_OPEN_SCOPE
 
@@ -57,33 +61,42 @@ public:
 
     /// Define a type that can hold one sample of any primvar.
     typedef char PrimvarTypeContainer[sizeof(GfMatrix4d)];
+
+    /// The scalar component type and component count of the given C++
+    /// type, known at compile time.
+    template<typename T>
+    struct ComponentTraits;
 };
 
 // Define template specializations of HdLuxCoreTypeHelper methods for
 // all our supported types...
-#define TYPE_HELPER(T,type)\
+#define TYPE_HELPER(T,type,component,count)\
 template<> inline HdTupleType \
-HdLuxCoreTypeHelper::GetTupleType<T>() { return HdTupleType{type, 1}; }
-
-    TYPE_HELPER(bool, HdTypeBool)
-    TYPE_HELPER(char, HdTypeInt8)
-    TYPE_HELPER(short, HdTypeInt16)
-    TYPE_HELPER(unsigned short, HdTypeUInt16)
-    TYPE_HELPER(int, HdTypeInt32)
-    TYPE_HELPER(GfVec2i, HdTypeInt32Vec2)
-    TYPE_HELPER(GfVec3i, HdTypeInt32Vec3)
-    TYPE_HELPER(GfVec4i, HdTypeInt32Vec4)
-    TYPE_HELPER(unsigned int, HdTypeUInt32)
-    TYPE_HELPER(float, HdTypeFloat)
-    TYPE_HELPER(GfVec2f, HdTypeFloatVec2)
-    TYPE_HELPER(GfVec3f, HdTypeFloatVec3)
-    TYPE_HELPER(GfVec4f, HdTypeFloatVec4)
-    TYPE_HELPER(double, HdTypeDouble)
-    TYPE_HELPER(GfVec2d, HdTypeDoubleVec2)
-    TYPE_HELPER(GfVec3d, HdTypeDoubleVec3)
-    TYPE_HELPER(GfVec4d, HdTypeDoubleVec4)
-    TYPE_HELPER(GfMatrix4f, HdTypeFloatMat4)
-    TYPE_HELPER(GfMatrix4d, HdTypeDoubleMat4)
+HdLuxCoreTypeHelper::GetTupleType<T>() { return HdTupleType{type, 1}; } \
+template<> struct HdLuxCoreTypeHelper::ComponentTraits<T> { \
+    typedef component ComponentType; \
+    static constexpr short NumComponents = count; \
+};
+
+    TYPE_HELPER(bool, HdTypeBool, bool, 1)
+    TYPE_HELPER(char, HdTypeInt8, char, 1)
+    TYPE_HELPER(short, HdTypeInt16, short, 1)
+    TYPE_HELPER(unsigned short, HdTypeUInt16, unsigned short, 1)
+    TYPE_HELPER(int, HdTypeInt32, int, 1)
+    TYPE_HELPER(GfVec2i, HdTypeInt32Vec2, int, 2)
+    TYPE_HELPER(GfVec3i, HdTypeInt32Vec3, int, 3)
+    TYPE_HELPER(GfVec4i, HdTypeInt32Vec4, int, 4)
+    TYPE_HELPER(unsigned int, HdTypeUInt32, unsigned int, 1)
+    TYPE_HELPER(float, HdTypeFloat, float, 1)
+    TYPE_HELPER(GfVec2f, HdTypeFloatVec2, float, 2)
+    TYPE_HELPER(GfVec3f, HdTypeFloatVec3, float, 3)
+    TYPE_HELPER(GfVec4f, HdTypeFloatVec4, float, 4)
+    TYPE_HELPER(double, HdTypeDouble, double, 1)
+    TYPE_HELPER(GfVec2d, HdTypeDoubleVec2, double, 2)
+    TYPE_HELPER(GfVec3d, HdTypeDoubleVec3, double, 3)
+    TYPE_HELPER(GfVec4d, HdTypeDoubleVec4, double, 4)
+    TYPE_HELPER(GfMatrix4f, HdTypeFloatMat4, float, 16)
+    TYPE_HELPER(GfMatrix4d, HdTypeDoubleMat4, double, 16)
 #undef TYPE_HELPER
 
 /// \class HdLuxCoreBufferSampler
@@ -128,6 +141,119 @@ private:
     HdVtBufferSource const& _buffer;
 };
 
+/// \class HdLuxCoreTypedBufferSampler
+///
+/// A typed counterpart to HdLuxCoreBufferSampler. The element type is fixed
+/// at compile time, so the buffer's tuple type is validated once, when the
+/// sampler is constructed, and sampling is a plain load rather than a
+/// type-checked, variable-size memcpy per element.
+///
+/// The sampler can also view a VtArray<T> held in a VtValue directly, which
+/// avoids copying the array into an HdVtBufferSource first.
+///
+/// A sampler over a buffer of the wrong type is invalid; every Sample()
+/// then returns false.
+///
+template<typename T>
+class HdLuxCoreTypedBufferSampler {
+public:
+    /// The constructor takes a reference to a buffer source. The data is
+    /// owned externally; the caller is responsible for ensuring the buffer
+    /// is alive while the sampler is in use.
+    /// \param buffer The buffer being sampled.
+    HdLuxCoreTypedBufferSampler(HdVtBufferSource const& buffer)
+        : _data(nullptr), _numElements(0)
+    {
+        if (buffer.GetTupleType() == HdLuxCoreTypeHelper::GetTupleType<T>()) {
+            _data = static_cast<const T*>(buffer.GetData());
+            _numElements = buffer.GetNumElements();
+        }
+    }
+
+    /// Construct a view over a VtArray<T> held by \p value. No data is
+    /// copied; the caller is responsible for keeping \p value (or another
+    /// reference to the same array) alive while the sampler is in use.
+    /// \param value The value holding the array being sampled.
+    HdLuxCoreTypedBufferSampler(VtValue const& value)
+        : _data(nullptr), _numElements(0)
+    {
+        if (value.IsHolding<VtArray<T>>()) {
+            VtArray<T> const& array = value.UncheckedGet<VtArray<T>>();
+            _data = array.cdata();
+            _numElements = array.size();
+        }
+    }
+
+    /// Return true if the buffer holds elements of type \p T.
+    bool IsValid() const {
+        return _data != nullptr;
+    }
+
+    /// Return the number of elements that can be sampled.
+    size_t GetNumElements() const {
+        return _numElements;
+    }
+
+    /// Sample the buffer at element index \p index, and write the sample to
+    /// \p value. Returns false if \p index is out of bounds.
+    bool Sample(int index, T* value) const {
+        if (_numElements <= (size_t)index) {
+            return false;
+        }
+        *value = _data[index];
+        return true;
+    }
+
+    /// Sample the buffer at each of the \p count element indices in
+    /// \p indices, writing the samples contiguously to \p values. Indices
+    /// that are out of bounds produce \p fallback.
+    /// \param indices The element indices to sample.
+    /// \param count The number of indices.
+    /// \param values The memory to write \p count samples to.
+    /// \param fallback The value written for out-of-bounds indices.
+    /// \return The number of indices that were in bounds.
+    size_t SampleRange(int const* indices, size_t count, T* values,
+                       T const& fallback) const {
+        TRACE_FUNCTION();
+        TRACE_COUNTER_DELTA("HdLuxCore sampled primvar elements", count);
+
+        size_t sampled = 0;
+        for (size_t i = 0; i < count; ++i) {
+            // Negative indices wrap around and fail the bounds check.
+            size_t const index = static_cast<size_t>(indices[i]);
+            if (index < _numElements) {
+                values[i] = _data[index];
+                ++sampled;
+            } else {
+                values[i] = fallback;
+            }
+        }
+        return sampled;
+    }
+
+private:
+    T const* _data;
+    size_t _numElements;
+};
+
+/// Blend \p sampleCount samples of \p N components of type \p C:
+/// \p out = sum_i { \p samples[i] * \p weights[i] }. The component count is
+/// a compile-time constant, so the loop can be unrolled and vectorized.
+template<typename C, short N>
+inline void
+HdLuxCoreInterpolateComponents(void* out, void const* const* samples,
+                               float const* weights, size_t sampleCount)
+{
+    C result[N] = {};
+    for (size_t j = 0; j < sampleCount; ++j) {
+        C const* sample = static_cast<C const*>(samples[j]);
+        for (short i = 0; i < N; ++i) {
+            result[i] += sample[i] * weights[j];
+        }
+    }
+    memcpy(out, result, sizeof(result));
+}
+
 /// \class HdLuxCorePrimvarSampler
 ///
 /// An abstract base class that knows how to sample a primvar signal given
@@ -178,6 +304,23 @@ protected:
     /// \return True if the samples were successfully combined.
     static bool _Interpolate(void* out, void** samples, float* weights,
         size_t sampleCount, HdTupleType dataType);
+
+    /// Typed variant of _Interpolate(). The component type and count come
+    /// from \p T at compile time, so there is no type dispatch per call and
+    /// the per-component loop can be unrolled and vectorized.
+    /// \param out The memory to write the output to.
+    /// \param samples The array of sample pointers (length \p sampleCount).
+    /// \param weights The array of sample weights (length \p sampleCount).
+    /// \param sampleCount The number of samples to combine.
+    template<typename T>
+    static void _Interpolate(T* out, T const* const* samples,
+        float const* weights, size_t sampleCount) {
+        typedef HdLuxCoreTypeHelper::ComponentTraits<T> Traits;
+        HdLuxCoreInterpolateComponents<typename Traits::ComponentType,
+                                       Traits::NumComponents>(out,
+            reinterpret_cast<void const* const*>(samples), weights,
+            sampleCount);
+    }
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,601 @@
+// Microbenchmarks of the HdLuxCore inner kernels.
+//
+// Each benchmark runs one kernel in isolation on fixed, generated inputs at
+// a few sizes, so an optimization can be measured before and after:
+//
+//   benchHdLuxCoreKernels [filter] [--min-time=seconds]
+//
+// Only benchmarks whose name contains filter run. Each one repeats its
+// kernel until it has run for at least min-time seconds (0.5 by default)
+// and reports the time per iteration and items processed per second.
+
+#include "pxr/pxr.h"
+#include "pxr/imaging/hdLuxCore/instancer.h"
+#include "pxr/imaging/hdLuxCore/mesh.h"
+#include "pxr/imaging/hdLuxCore/sampler.h"
+
+#include "pxr/imaging/hd/renderIndex.h"
+#include "pxr/imaging/hd/sceneDelegate.h"
+#include "pxr/imaging/hd/unitTestNullRenderDelegate.h"
+#include "pxr/imaging/hd/vtBufferSource.h"
+#include "pxr/usd/sdf/path.h"
+#include "pxr/base/tf/stringUtils.h"
+#include "pxr/base/tf/token.h"
+#include "pxr/base/vt/array.h"
+#include "pxr/base/vt/value.h"
+
+#include <opensubdiv/far/stencilTableFactory.h>
+#include <opensubdiv/far/topologyDescriptor.h>
+#include <opensubdiv/far/topologyRefinerFactory.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+PXR_NAMESPACE_USING_DIRECTIVE
+
+using namespace OpenSubdiv;
+
+namespace {
+
+// Benchmark harness, modelled on Google Benchmark's State and registration.
+
+class _State {
+public:
+    _State(int64_t arg, int64_t iterations)
+        : _arg(arg), _iterations(iterations), _remaining(iterations),
+          _itemsProcessed(0), _paused(std::chrono::steady_clock::duration::zero()),
+          _elapsed(std::chrono::steady_clock::duration::zero()) {}
+
+    /// Return true while the benchmark loop should run another iteration.
+    bool KeepRunning() {
+        if (_remaining == _iterations) {
+            _start = std::chrono::steady_clock::now();
+        }
+        if (_remaining-- > 0) {
+            return true;
+        }
+        _elapsed = std::chrono::steady_clock::now() - _start - _paused;
+        return false;
+    }
+
+    /// Exclude the time until ResumeTiming() from the measurement, for
+    /// per-iteration setup and cleanup.
+    void PauseTiming() {
+        _pauseStart = std::chrono::steady_clock::now();
+    }
+
+    void ResumeTiming() {
+        _paused += std::chrono::steady_clock::now() - _pauseStart;
+    }
+
+    /// The size argument the benchmark was registered with.
+    int64_t GetArg() const {
+        return _arg;
+    }
+
+    /// Set the number of items all iterations processed together.
+    void SetItemsProcessed(int64_t items) {
+        _itemsProcessed = items;
+    }
+
+    int64_t GetIterations() const {
+        return _iterations;
+    }
+
+    int64_t GetItemsProcessed() const {
+        return _itemsProcessed;
+    }
+
+    double GetSeconds() const {
+        return std::chrono::duration<double>(_elapsed).count();
+    }
+
+private:
+    int64_t _arg;
+    int64_t _iterations;
+    int64_t _remaining;
+    int64_t _itemsProcessed;
+    std::chrono::steady_clock::time_point _start;
+    std::chrono::steady_clock::time_point _pauseStart;
+    std::chrono::steady_clock::duration _paused;
+    std::chrono::steady_clock::duration _elapsed;
+};
+
+struct _Benchmark {
+    std::string name;
+    std::function<void(_State&)> function;
+    std::vector<int64_t> args;
+};
+
+std::vector<_Benchmark> &
+_GetBenchmarks()
+{
+    static std::vector<_Benchmark> benchmarks;
+    return benchmarks;
+}
+
+void
+_Register(std::string const& name, std::function<void(_State&)> function,
+          std::vector<int64_t> const& args)
+{
+    _GetBenchmarks().push_back(_Benchmark{name, function, args});
+}
+
+// Keep the compiler from optimizing away a value the benchmark computes.
+template<typename T>
+inline void
+_DoNotOptimize(T const& value)
+{
+#if defined(_MSC_VER)
+    static volatile char sink;
+    sink = *reinterpret_cast<char const volatile*>(&value);
+#else
+    asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+// Run \p benchmark with \p arg, growing the iteration count until the run
+// takes at least \p minTime seconds.
+void
+_Run(_Benchmark const& benchmark, int64_t arg, double minTime)
+{
+    int64_t iterations = 1;
+    while (true) {
+        _State state(arg, iterations);
+        benchmark.function(state);
+
+        double const seconds = state.GetSeconds();
+        if (seconds >= minTime || iterations >= (int64_t(1) << 40)) {
+            double const itemsPerSecond = seconds > 0.0 ?
+                state.GetItemsProcessed() / seconds : 0.0;
+            std::printf("%-56s %12lld %14.1f ns %14.4g items/s\n",
+                (benchmark.name + "/" + std::to_string(arg)).c_str(),
+                static_cast<long long>(iterations),
+                seconds * 1e9 / iterations, itemsPerSecond);
+            return;
+        }
+
+        // Aim past the minimum time, growing at most tenfold per attempt
+        double const scale = seconds > 0.0 ? 1.4 * minTime / seconds : 10.0;
+        iterations = std::max(iterations + 1, static_cast<int64_t>(
+            iterations * std::min(scale, 10.0)));
+    }
+}
+
+// Fixed inputs: every run of a benchmark sees the same data.
+
+template<typename T>
+T
+_MakeValue(std::mt19937 &random)
+{
+    typedef typename HdLuxCoreTypeHelper::ComponentTraits<T>::ComponentType C;
+    std::uniform_real_distribution<double> distribution(-1.0, 1.0);
+    T value;
+    C *components = reinterpret_cast<C*>(&value);
+    for (short i = 0; i < HdLuxCoreTypeHelper::ComponentTraits<T>::NumComponents; ++i) {
+        components[i] = static_cast<C>(distribution(random));
+    }
+    return value;
+}
+
+template<typename T>
+VtArray<T>
+_MakeArray(size_t size, unsigned int seed)
+{
+    std::mt19937 random(seed);
+    VtArray<T> values(size);
+    for (T &value : values) {
+        value = _MakeValue<T>(random);
+    }
+    return values;
+}
+
+// Random indices into an array of \p size elements
+std::vector<int>
+_MakeIndices(size_t size, unsigned int seed)
+{
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<int> distribution(0, int(size) - 1);
+    std::vector<int> indices(size);
+    for (int &index : indices) {
+        index = distribution(random);
+    }
+    return indices;
+}
+
+// A regular grid of about \p triangleCount triangles in the XY plane, two
+// per quad, so the mesh has both interior and boundary edges
+void
+_MakeGrid(size_t triangleCount, VtVec3fArray *points, VtVec3iArray *triangles)
+{
+    int const quads = std::max(1, static_cast<int>(
+        std::lround(std::sqrt(triangleCount / 2.0))));
+    int const side = quads + 1;
+
+    points->resize(side * side);
+    GfVec3f *pointData = points->data();
+    for (int y = 0; y < side; ++y) {
+        for (int x = 0; x < side; ++x) {
+            pointData[y * side + x] = GfVec3f(x, y, 0.0f);
+        }
+    }
+
+    triangles->resize(2 * quads * quads);
+    GfVec3i *triangleData = triangles->data();
+    for (int y = 0; y < quads; ++y) {
+        for (int x = 0; x < quads; ++x) {
+            int const v = y * side + x;
+            int const quad = y * quads + x;
+            triangleData[2 * quad] = GfVec3i(v, v + 1, v + side + 1);
+            triangleData[2 * quad + 1] = GfVec3i(v, v + side + 1, v + side);
+        }
+    }
+}
+
+// Instancer kernels
+
+// A scene delegate serving the primvars of nested point instancers, each
+// with a single prototype.
+class _InstancerDelegate : public HdSceneDelegate {
+public:
+    explicit _InstancerDelegate(HdRenderIndex *renderIndex)
+        : HdSceneDelegate(renderIndex, SdfPath::AbsoluteRootPath()) {}
+
+    /// Add an instancer of \p count instances with random translate,
+    /// rotate and scale primvars, nested in \p parentId if not empty.
+    void AddInstancer(SdfPath const& id, SdfPath const& parentId,
+                      size_t count, unsigned int seed) {
+        GetRenderIndex().InsertInstancer(this, id, parentId);
+
+        _Instancer &instancer = _instancers[id];
+        instancer.indices = VtIntArray(count);
+        std::iota(instancer.indices.begin(), instancer.indices.end(), 0);
+        instancer.primvars[TfToken("translate")] =
+            VtValue(_MakeArray<GfVec3f>(count, seed));
+        instancer.primvars[TfToken("rotate")] =
+            VtValue(_MakeArray<GfVec4f>(count, seed + 1));
+        instancer.primvars[TfToken("scale")] =
+            VtValue(_MakeArray<GfVec3f>(count, seed + 2));
+    }
+
+    HdPrimvarDescriptorVector GetPrimvarDescriptors(
+        SdfPath const& id, HdInterpolation interpolation) override {
+        HdPrimvarDescriptorVector primvars;
+        if (interpolation == HdInterpolationInstance) {
+            for (auto const& primvar : _instancers[id].primvars) {
+                primvars.push_back(
+                    HdPrimvarDescriptor(primvar.first, interpolation));
+            }
+        }
+        return primvars;
+    }
+
+    VtValue Get(SdfPath const& id, TfToken const& key) override {
+        return _instancers[id].primvars[key];
+    }
+
+    GfMatrix4d GetInstancerTransform(SdfPath const& instancerId) override {
+        return GfMatrix4d(1);
+    }
+
+    VtIntArray GetInstanceIndices(SdfPath const& instancerId,
+                                  SdfPath const& prototypeId) override {
+        return _instancers[instancerId].indices;
+    }
+
+private:
+    struct _Instancer {
+        VtIntArray indices;
+        std::map<TfToken, VtValue> primvars;
+    };
+    std::map<SdfPath, _Instancer> _instancers;
+};
+
+// A render delegate creating HdLuxCoreInstancers and null prims, so the
+// instancers can be benchmarked without a LuxCore session.
+class _InstancerRenderDelegate : public Hd_UnitTestNullRenderDelegate {
+public:
+    HdInstancer *CreateInstancer(HdSceneDelegate *delegate,
+                                 SdfPath const& id,
+                                 SdfPath const& instancerId) override {
+        return new HdLuxCoreInstancer(delegate, id, instancerId);
+    }
+
+    void DestroyInstancer(HdInstancer *instancer) override {
+        delete instancer;
+    }
+};
+
+// HdLuxCoreInstancer::ComputeInstanceTransforms() for \p Depth levels of
+// nested instancers, of about GetArg() instances in all
+template<int Depth>
+void
+_BenchComputeInstanceTransforms(_State &state)
+{
+    size_t const count = static_cast<size_t>(std::lround(
+        std::pow(static_cast<double>(state.GetArg()), 1.0 / Depth)));
+
+    _InstancerRenderDelegate renderDelegate;
+    std::unique_ptr<HdRenderIndex> renderIndex(
+        HdRenderIndex::New(&renderDelegate));
+    _InstancerDelegate delegate(renderIndex.get());
+
+    SdfPath id;
+    for (int level = 0; level < Depth; ++level) {
+        SdfPath const parentId = id;
+        id = SdfPath(TfStringPrintf("/Instancer%d", level));
+        delegate.AddInstancer(id, parentId, count, 3 * level + 1);
+    }
+    HdLuxCoreInstancer *instancer =
+        static_cast<HdLuxCoreInstancer*>(renderIndex->GetInstancer(id));
+    SdfPath const prototypeId("/Prototype");
+
+    size_t instances = 0;
+    while (state.KeepRunning()) {
+        VtMatrix4dArray const transforms =
+            instancer->ComputeInstanceTransforms(prototypeId);
+        instances = transforms.size();
+        _DoNotOptimize(transforms.cdata());
+    }
+    state.SetItemsProcessed(state.GetIterations() * instances);
+}
+
+// Mesh kernels
+
+// HdLuxCoreFindBoundaryVertices() on a grid of GetArg() triangles
+void
+_BenchFindBoundaryVertices(_State &state)
+{
+    VtVec3fArray points;
+    VtVec3iArray triangles;
+    _MakeGrid(state.GetArg(), &points, &triangles);
+
+    while (state.KeepRunning()) {
+        std::vector<int> const boundaryVertices =
+            HdLuxCoreFindBoundaryVertices(triangles, points.size());
+        _DoNotOptimize(boundaryVertices.size());
+    }
+    state.SetItemsProcessed(state.GetIterations() * triangles.size());
+}
+
+// HdLuxCoreBuildBuffer<3>() refining the points of a grid of GetArg()
+// triangles by two levels of loop subdivision, as HdLuxCoreMesh does
+void
+_BenchBuildBuffer(_State &state)
+{
+    VtVec3fArray points;
+    VtVec3iArray triangles;
+    _MakeGrid(state.GetArg(), &points, &triangles);
+
+    Sdc::Options options;
+    options.SetVtxBoundaryInterpolation(
+        Sdc::Options::VTX_BOUNDARY_EDGE_AND_CORNER);
+
+    Far::TopologyDescriptor desc;
+    desc.numVertices = points.size();
+    desc.numFaces = triangles.size();
+    std::vector<int> vertsPerFace(desc.numFaces, 3);
+    desc.numVertsPerFace = vertsPerFace.data();
+    desc.vertIndicesPerFace =
+        reinterpret_cast<int const*>(triangles.cdata());
+
+    typedef Far::TopologyRefinerFactory<Far::TopologyDescriptor>
+        RefinerFactory;
+    std::unique_ptr<Far::TopologyRefiner> refiner(RefinerFactory::Create(
+        desc, RefinerFactory::Options(Sdc::SCHEME_LOOP, options)));
+    refiner->RefineUniform(Far::TopologyRefiner::UniformOptions(2));
+
+    Far::StencilTableFactory::Options stencilOptions;
+    stencilOptions.generateOffsets = true;
+    stencilOptions.generateIntermediateLevels = false;
+    std::unique_ptr<Far::StencilTable const> stencilTable(
+        Far::StencilTableFactory::Create(*refiner, stencilOptions));
+
+    unsigned int const count = refiner->GetLevel(0).GetNumVertices();
+    unsigned int const totalCount = count + refiner->GetNumVerticesTotal();
+
+    while (state.KeepRunning()) {
+        Osd::CpuVertexBuffer *buffer = HdLuxCoreBuildBuffer<3>(
+            stencilTable.get(), reinterpret_cast<float const*>(points.cdata()),
+            count, totalCount);
+        _DoNotOptimize(buffer);
+
+        state.PauseTiming();
+        delete buffer;
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(
+        state.GetIterations() * stencilTable->GetNumStencils());
+}
+
+// HdLuxCorePackMesh() on a grid of GetArg() triangles
+void
+_BenchPackMesh(_State &state)
+{
+    VtVec3fArray points;
+    VtVec3iArray triangles;
+    _MakeGrid(state.GetArg(), &points, &triangles);
+
+    std::vector<float> vertices(3 * points.size());
+    std::vector<unsigned int> triangleIndices(3 * triangles.size());
+    while (state.KeepRunning()) {
+        HdLuxCorePackMesh(points, triangles,
+                          vertices.data(), triangleIndices.data());
+        _DoNotOptimize(vertices.data());
+        _DoNotOptimize(triangleIndices.data());
+    }
+    state.SetItemsProcessed(state.GetIterations() * triangles.size());
+}
+
+// Sampler kernels
+
+// Exposes HdLuxCorePrimvarSampler's interpolation to the benchmarks.
+class _InterpolationKernels : public HdLuxCorePrimvarSampler {
+public:
+    bool Sample(unsigned int, float, float, void*,
+                HdTupleType) const override {
+        return false;
+    }
+
+    using HdLuxCorePrimvarSampler::_Interpolate;
+};
+
+// HdLuxCoreBufferSampler::Sample() at random indices
+template<typename T>
+void
+_BenchBufferSample(_State &state)
+{
+    size_t const size = state.GetArg();
+    HdVtBufferSource buffer(TfToken("primvar"),
+                            VtValue(_MakeArray<T>(size, 1)));
+    HdLuxCoreBufferSampler sampler(buffer);
+    std::vector<int> const indices = _MakeIndices(size, 2);
+
+    T value;
+    while (state.KeepRunning()) {
+        for (int index : indices) {
+            sampler.Sample(index, &value);
+            _DoNotOptimize(value);
+        }
+    }
+    state.SetItemsProcessed(state.GetIterations() * size);
+}
+
+// HdLuxCoreTypedBufferSampler::SampleRange() at random indices
+template<typename T>
+void
+_BenchTypedSampleRange(_State &state)
+{
+    size_t const size = state.GetArg();
+    VtValue const value(_MakeArray<T>(size, 1));
+    HdLuxCoreTypedBufferSampler<T> sampler(value);
+    std::vector<int> const indices = _MakeIndices(size, 2);
+
+    std::vector<T> values(size);
+    while (state.KeepRunning()) {
+        sampler.SampleRange(indices.data(), size, values.data(), T());
+        _DoNotOptimize(values.data());
+    }
+    state.SetItemsProcessed(state.GetIterations() * size);
+}
+
+// Barycentric blends of three samples, as triangle primvars are sampled,
+// through the type-dispatched or the typed _Interpolate()
+template<typename T, bool Typed>
+void
+_BenchInterpolate(_State &state)
+{
+    size_t const size = state.GetArg();
+    VtArray<T> const samples = _MakeArray<T>(size, 1);
+    std::vector<int> const indices = _MakeIndices(3 * size, 2);
+    HdTupleType const dataType = HdLuxCoreTypeHelper::GetTupleType<T>();
+    float weights[3] = { 0.2f, 0.3f, 0.5f };
+
+    T value;
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < size; ++i) {
+            T const* corners[3] = {
+                &samples[indices[3 * i]],
+                &samples[indices[3 * i + 1]],
+                &samples[indices[3 * i + 2]]
+            };
+            if (Typed) {
+                _InterpolationKernels::_Interpolate(&value, corners,
+                                                    weights, 3);
+            } else {
+                _InterpolationKernels::_Interpolate(&value,
+                    const_cast<void**>(
+                        reinterpret_cast<void const* const*>(corners)),
+                    weights, 3, dataType);
+            }
+            _DoNotOptimize(value);
+        }
+    }
+    state.SetItemsProcessed(state.GetIterations() * size);
+}
+
+template<typename T>
+void
+_RegisterSamplerBenchmarks(std::string const& typeName)
+{
+    std::vector<int64_t> const sizes = { 1 << 10, 1 << 16, 1 << 20 };
+    _Register("BufferSampler::Sample<" + typeName + ">",
+              _BenchBufferSample<T>, sizes);
+    _Register("TypedBufferSampler::SampleRange<" + typeName + ">",
+              _BenchTypedSampleRange<T>, sizes);
+    _Register("PrimvarSampler::_Interpolate<" + typeName + ">/dispatch",
+              _BenchInterpolate<T, false>, sizes);
+    _Register("PrimvarSampler::_Interpolate<" + typeName + ">/typed",
+              _BenchInterpolate<T, true>, sizes);
+}
+
+void
+_RegisterBenchmarks()
+{
+    // Sizes that are squares and cubes, so every nesting level has the
+    // same number of instances
+    std::vector<int64_t> const instanceCounts = { 1 << 6, 1 << 12, 1 << 18 };
+    _Register("Instancer::ComputeInstanceTransforms/depth:1",
+              _BenchComputeInstanceTransforms<1>, instanceCounts);
+    _Register("Instancer::ComputeInstanceTransforms/depth:2",
+              _BenchComputeInstanceTransforms<2>, instanceCounts);
+    _Register("Instancer::ComputeInstanceTransforms/depth:3",
+              _BenchComputeInstanceTransforms<3>, instanceCounts);
+
+    std::vector<int64_t> const triangleCounts = { 1 << 10, 1 << 16, 1 << 20 };
+    _Register("Mesh::FindBoundaryVertices",
+              _BenchFindBoundaryVertices, triangleCounts);
+    _Register("Mesh::PackMesh", _BenchPackMesh, triangleCounts);
+    // Two levels of subdivision multiply the vertex count by about 16
+    _Register("Mesh::BuildBuffer<3>", _BenchBuildBuffer,
+              { 1 << 8, 1 << 12, 1 << 16 });
+
+    _RegisterSamplerBenchmarks<float>("float");
+    _RegisterSamplerBenchmarks<GfVec2f>("GfVec2f");
+    _RegisterSamplerBenchmarks<GfVec3f>("GfVec3f");
+    _RegisterSamplerBenchmarks<GfVec4f>("GfVec4f");
+    _RegisterSamplerBenchmarks<GfMatrix4d>("GfMatrix4d");
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char *argv[])
+{
+    std::string filter;
+    double minTime = 0.5;
+    for (int i = 1; i < argc; ++i) {
+        std::string const arg = argv[i];
+        if (arg.compare(0, 11, "--min-time=") == 0) {
+            minTime = std::atof(arg.c_str() + 11);
+        } else {
+            filter = arg;
+        }
+    }
+
+    _RegisterBenchmarks();
+
+    std::printf("%-56s %12s %17s %22s\n",
+                "Benchmark", "Iterations", "Time", "Throughput");
+    for (_Benchmark const& benchmark : _GetBenchmarks()) {
+        if (benchmark.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        for (int64_t arg : benchmark.args) {
+            _Run(benchmark, arg, minTime);
+        }
+    }
+    return 0;
+}
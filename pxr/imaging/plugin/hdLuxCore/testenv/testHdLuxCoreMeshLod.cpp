@@ -0,0 +1,79 @@
+// Checks that HdLuxCoreMesh subdivides smooth meshes from their scheme and
+// refine level, whatever their path, and that the level of detail it picks
+// for an instance follows the instance's distance to the camera.
+
+#include "pxr/pxr.h"
+#include "pxr/imaging/hdLuxCore/mesh.h"
+
+#include "pxr/imaging/pxOsd/tokens.h"
+#include "pxr/base/gf/matrix4d.h"
+#include "pxr/base/gf/vec3d.h"
+#include "pxr/base/tf/diagnostic.h"
+
+#include <iostream>
+
+PXR_NAMESPACE_USING_DIRECTIVE
+
+static int
+_LodAtDistance(double distance, int maxLod, int currentLod,
+               HdLuxCoreLodContext const& lodContext)
+{
+    GfMatrix4d transform(1.0);
+    transform.SetTranslate(GfVec3d(0.0, 0.0, -distance));
+    return HdLuxCoreSelectInstanceLod(transform, GfVec3d(0.0), 1.0, maxLod,
+                                      currentLod, lodContext);
+}
+
+static void
+TestSubdivisionLevels()
+{
+    TF_AXIOM(HdLuxCoreGetSubdivisionLevels(
+                 PxOsdOpenSubdivTokens->catmullClark, 0) == 0);
+    TF_AXIOM(HdLuxCoreGetSubdivisionLevels(
+                 PxOsdOpenSubdivTokens->catmullClark, 2) == 3);
+    TF_AXIOM(HdLuxCoreGetSubdivisionLevels(
+                 PxOsdOpenSubdivTokens->loop, 1) == 2);
+    TF_AXIOM(HdLuxCoreGetSubdivisionLevels(
+                 PxOsdOpenSubdivTokens->none, 2) == 0);
+    TF_AXIOM(HdLuxCoreGetSubdivisionLevels(
+                 PxOsdOpenSubdivTokens->bilinear, 2) == 0);
+}
+
+static void
+TestLodFollowsDistance()
+{
+    // A catmullClark mesh, e.g. /World/rock, at refine level 2
+    int const maxLod = HdLuxCoreGetSubdivisionLevels(
+        PxOsdOpenSubdivTokens->catmullClark, 2);
+    TF_AXIOM(maxLod > 0);
+
+    HdLuxCoreLodContext lodContext;
+    lodContext.enabled = true;
+    lodContext.pixelScale = 1000.0;
+    lodContext.pixelThreshold = 32.0;
+
+    // 100, 10 and 1 pixels across
+    int const nearLod = _LodAtDistance(10.0, maxLod, -1, lodContext);
+    int const midLod = _LodAtDistance(100.0, maxLod, -1, lodContext);
+    int const farLod = _LodAtDistance(1000.0, maxLod, -1, lodContext);
+    TF_AXIOM(nearLod == 0);
+    TF_AXIOM(midLod == 2);
+    TF_AXIOM(farLod == maxLod);
+
+    // The camera inside the bounds always gets the full shape
+    TF_AXIOM(_LodAtDistance(0.5, maxLod, -1, lodContext) == 0);
+
+    // Just past the threshold, an instance keeps its level
+    TF_AXIOM(_LodAtDistance(35.0, maxLod, 0, lodContext) == 0);
+    TF_AXIOM(_LodAtDistance(35.0, maxLod, -1, lodContext) == 1);
+}
+
+int
+main(int argc, char *argv[])
+{
+    TestSubdivisionLevels();
+    TestLodFollowsDistance();
+
+    std::cout << "OK" << std::endl;
+    return 0;
+}
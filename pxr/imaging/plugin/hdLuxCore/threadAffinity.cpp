@@ -0,0 +1,192 @@
+#include "pxr/imaging/hdLuxCore/threadAffinity.h"
+
+#include "pxr/base/tf/diagnostic.h"
+#include "pxr/base/tf/stringUtils.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+namespace {
+
+#if defined(__linux__)
+
+bool
+_SetThreadCpus(std::vector<int> const& cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+#else
+
+// Render threads can't be placed elsewhere: macOS has no affinity API, and
+// on Windows new threads start with the process affinity rather than the
+// affinity of the thread creating them.
+
+bool
+_SetThreadCpus(std::vector<int> const&)
+{
+    return false;
+}
+
+#endif
+
+} // anonymous namespace
+
+bool
+HdLuxCoreParseCpuList(std::string const& list, std::vector<int> *cpus)
+{
+    cpus->clear();
+    for (std::string const& range : TfStringTokenize(list, ",")) {
+        std::vector<std::string> const bounds = TfStringSplit(TfStringTrim(range), "-");
+        if (bounds.empty() || bounds.size() > 2) {
+            return false;
+        }
+
+        int first = 0, last = 0;
+        for (size_t i = 0; i < bounds.size(); i++) {
+            std::string const bound = TfStringTrim(bounds[i]);
+            char *end = nullptr;
+            long const value = strtol(bound.c_str(), &end, 10);
+            if (bound.empty() || *end != '\0' || value < 0 || value > 65535) {
+                return false;
+            }
+            (i == 0 ? first : last) = static_cast<int>(value);
+        }
+        if (bounds.size() == 1) {
+            last = first;
+        }
+        if (last < first) {
+            return false;
+        }
+
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus->push_back(cpu);
+        }
+    }
+
+    std::sort(cpus->begin(), cpus->end());
+    cpus->erase(std::unique(cpus->begin(), cpus->end()), cpus->end());
+    return true;
+}
+
+std::string
+HdLuxCoreFormatCpuList(std::vector<int> const& cpus)
+{
+    std::string list;
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+            j++;
+        }
+
+        if (!list.empty()) {
+            list += ",";
+        }
+        list += (i == j) ? TfStringPrintf("%d", cpus[i]) :
+                           TfStringPrintf("%d-%d", cpus[i], cpus[j]);
+        i = j + 1;
+    }
+    return list;
+}
+
+std::vector<int>
+HdLuxCoreGetThreadCpus()
+{
+    std::vector<int> cpus;
+
+#if defined(__linux__)
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+
+    if (cpus.empty()) {
+        for (int cpu = 0; cpu < static_cast<int>(std::thread::hardware_concurrency()); cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+std::vector<std::vector<int>>
+HdLuxCoreGetNumaNodes()
+{
+    std::vector<std::pair<int, std::vector<int>>> nodes;
+
+#if defined(__linux__)
+    static const char *nodeDirectory = "/sys/devices/system/node";
+    if (DIR *dir = opendir(nodeDirectory)) {
+        while (dirent *entry = readdir(dir)) {
+            std::string const name = entry->d_name;
+            if (!TfStringStartsWith(name, "node") || name.size() == 4 ||
+                name.find_first_not_of("0123456789", 4) != std::string::npos) {
+                continue;
+            }
+
+            std::ifstream file(std::string(nodeDirectory) + "/" + name + "/cpulist");
+            std::string list;
+            std::vector<int> cpus;
+            if (std::getline(file, list) && HdLuxCoreParseCpuList(list, &cpus) &&
+                !cpus.empty()) {
+                nodes.emplace_back(atoi(name.c_str() + 4), std::move(cpus));
+            }
+        }
+        closedir(dir);
+    }
+#endif
+
+    std::sort(nodes.begin(), nodes.end());
+
+    std::vector<std::vector<int>> result;
+    for (auto& node : nodes) {
+        result.push_back(std::move(node.second));
+    }
+    if (result.empty()) {
+        result.push_back(HdLuxCoreGetThreadCpus());
+    }
+    return result;
+}
+
+HdLuxCoreScopedThreadAffinity::HdLuxCoreScopedThreadAffinity(
+    std::vector<int> const& cpus)
+    : _applied(false)
+{
+    if (!cpus.empty()) {
+        _previousCpus = HdLuxCoreGetThreadCpus();
+        _applied = _SetThreadCpus(cpus);
+        if (!_applied) {
+            TF_WARN("Cannot restrict render threads to CPUs %s",
+                    HdLuxCoreFormatCpuList(cpus).c_str());
+        }
+    }
+}
+
+HdLuxCoreScopedThreadAffinity::~HdLuxCoreScopedThreadAffinity()
+{
+    if (_applied) {
+        _SetThreadCpus(_previousCpus);
+    }
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,59 @@
+#ifndef HDLUXCORE_THREAD_AFFINITY_H
+#define HDLUXCORE_THREAD_AFFINITY_H
+
+#include "pxr/pxr.h"
+
+#include <string>
+#include <vector>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+/// Parse a CPU list in the Linux cpuset format, e.g. "0-7,16-23".
+///   \param list The CPU list.
+///   \param cpus Set to the sorted, unique CPU indices of \p list.
+///   \return False if \p list is malformed.
+bool HdLuxCoreParseCpuList(std::string const& list, std::vector<int> *cpus);
+
+/// Format sorted CPU indices as a CPU list, e.g. "0-7,16-23".
+std::string HdLuxCoreFormatCpuList(std::vector<int> const& cpus);
+
+/// Return the sorted indices of the CPUs the calling thread may run on. Where
+/// thread affinity isn't supported, all CPUs are reported.
+std::vector<int> HdLuxCoreGetThreadCpus();
+
+/// Return the CPUs of each NUMA node, in node order. Where the topology is
+/// unknown, all CPUs are reported as a single node.
+std::vector<std::vector<int>> HdLuxCoreGetNumaNodes();
+
+///
+/// \class HdLuxCoreScopedThreadAffinity
+///
+/// Restricts the calling thread to a set of CPUs for the lifetime of the
+/// object, then restores its previous affinity. Threads created in the
+/// meantime inherit the restriction, which is how LuxCore's render threads,
+/// created on RenderSession::Start() and again when a scene edit ends, are
+/// placed.
+///
+/// Affinity is only supported on Linux; elsewhere this does nothing. On
+/// Windows new threads start with the process affinity rather than their
+/// creator's, so the render threads can't be placed this way.
+///
+class HdLuxCoreScopedThreadAffinity {
+public:
+    /// Restrict the calling thread to \p cpus. An empty list leaves the
+    /// affinity unchanged.
+    explicit HdLuxCoreScopedThreadAffinity(std::vector<int> const& cpus);
+    ~HdLuxCoreScopedThreadAffinity();
+
+private:
+    std::vector<int> _previousCpus;
+    bool _applied;
+
+    // This class does not support copying.
+    HdLuxCoreScopedThreadAffinity(const HdLuxCoreScopedThreadAffinity&) = delete;
+    HdLuxCoreScopedThreadAffinity &operator =(const HdLuxCoreScopedThreadAffinity&) = delete;
+};
+
+PXR_NAMESPACE_CLOSE_SCOPE
+
+#endif // HDLUXCORE_THREAD_AFFINITY_H
@@ -0,0 +1,323 @@
+#include "pxr/imaging/hdLuxCore/trace.h"
+
+#include "pxr/base/tf/envSetting.h"
+#include "pxr/base/tf/stringUtils.h"
+#include "pxr/base/trace/collector.h"
+#include "pxr/base/trace/reporter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+TF_DEFINE_ENV_SETTING(HDLUXCORE_LOG_LEVEL, 2,
+    "HdLuxCore log level: 0 off, 1 errors, 2 warnings, 3 info, 4 debug.");
+TF_DEFINE_ENV_SETTING(HDLUXCORE_LOG_FILE, "",
+    "File HdLuxCore log records are appended to; stderr if empty.");
+TF_DEFINE_ENV_SETTING(HDLUXCORE_LUXCORE_LOG_RATE, 20,
+    "Maximum number of LuxCore log messages logged per second.");
+TF_DEFINE_ENV_SETTING(HDLUXCORE_TRACE_REPORT, "",
+    "File a trace report is written to when the render delegate is "
+    "destroyed; Chrome tracing format if it ends in .json.");
+
+namespace {
+
+// A fixed size log record; longer messages are truncated
+struct _Record {
+    std::chrono::steady_clock::duration time;
+    size_t thread;
+    int level;
+    char message[232];
+};
+
+// A single producer, single consumer ring of records. The owning thread
+// pushes records, the flusher thread pops them; neither takes a lock.
+struct _Ring {
+    static const size_t Capacity = 512;
+
+    bool Push(_Record const& record) {
+        size_t const head = _head.load(std::memory_order_relaxed);
+        if (head - _tail.load(std::memory_order_acquire) == Capacity) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        _records[head % Capacity] = record;
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    void PopAll(std::vector<_Record> *records) {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        size_t const head = _head.load(std::memory_order_acquire);
+        for (; tail != head; tail++) {
+            records->push_back(_records[tail % Capacity]);
+        }
+        _tail.store(tail, std::memory_order_release);
+    }
+
+    std::atomic<size_t> dropped{0};
+
+private:
+    _Record _records[Capacity];
+    std::atomic<size_t> _head{0};
+    std::atomic<size_t> _tail{0};
+};
+
+// Owns the rings of all threads that logged, so records survive the exit
+// of their thread, and the thread writing them out. Rings of exited threads
+// are reused by new ones, so LuxCore respawning its render threads on every
+// scene edit doesn't grow the sink.
+class _Sink {
+public:
+    _Sink()
+        : _start(std::chrono::steady_clock::now())
+    {
+        std::string const path = TfGetEnvSetting(HDLUXCORE_LOG_FILE);
+        _file = path.empty() ? nullptr : fopen(path.c_str(), "a");
+        if (!_file) {
+            _file = stderr;
+        }
+
+        _flusher = std::thread(&_Sink::_Run, this);
+    }
+
+    ~_Sink() {
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            _stop = true;
+        }
+        _wakeup.notify_one();
+        _flusher.join();
+        _Flush();
+
+        if (_file != stderr) {
+            fclose(_file);
+        }
+    }
+
+    static _Sink &Get() {
+        static _Sink sink;
+        return sink;
+    }
+
+    // Return the calling thread's ring, taking a free one or registering a
+    // new one on first use
+    _Ring *GetRing() {
+        thread_local _RingOwner owner;
+        if (!owner.ring) {
+            std::lock_guard<std::mutex> guard(_mutex);
+            if (_freeRings.empty()) {
+                _rings.emplace_back(new _Ring());
+                owner.ring = _rings.back().get();
+            } else {
+                owner.ring = _freeRings.back();
+                _freeRings.pop_back();
+            }
+            owner.sink = this;
+        }
+        return owner.ring;
+    }
+
+    std::chrono::steady_clock::duration GetTime() const {
+        return std::chrono::steady_clock::now() - _start;
+    }
+
+    void Flush() {
+        std::lock_guard<std::mutex> guard(_flushMutex);
+        _Flush();
+    }
+
+private:
+    // Returns a thread's ring to the free list when the thread exits. The
+    // ring stays registered, so records it still holds are written out by
+    // the next flush; the sink mutex orders the old owner's pushes before
+    // the new owner's.
+    struct _RingOwner {
+        _Sink *sink = nullptr;
+        _Ring *ring = nullptr;
+
+        ~_RingOwner() {
+            if (ring) {
+                std::lock_guard<std::mutex> guard(sink->_mutex);
+                sink->_freeRings.push_back(ring);
+            }
+        }
+    };
+
+    void _Run() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_stop) {
+            _wakeup.wait_for(lock, std::chrono::milliseconds(100));
+            lock.unlock();
+            Flush();
+            lock.lock();
+        }
+    }
+
+    // Write out the records of all rings in time order
+    void _Flush() {
+        std::vector<_Ring*> rings;
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            for (auto const& ring : _rings) {
+                rings.push_back(ring.get());
+            }
+        }
+
+        _buffer.clear();
+        size_t dropped = 0;
+        for (_Ring *ring : rings) {
+            ring->PopAll(&_buffer);
+            dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+        }
+        if (_buffer.empty() && dropped == 0) {
+            return;
+        }
+
+        std::stable_sort(_buffer.begin(), _buffer.end(),
+            [](_Record const& a, _Record const& b) { return a.time < b.time; });
+
+        static const char *levels[] = { "", "ERROR", "WARNING", "INFO", "DEBUG" };
+        for (_Record const& record : _buffer) {
+            double const seconds =
+                std::chrono::duration<double>(record.time).count();
+            fprintf(_file, "HdLuxCore %10.6f [%zx] %s: %s\n", seconds,
+                    record.thread, levels[record.level], record.message);
+        }
+        if (dropped) {
+            fprintf(_file, "HdLuxCore: %zu log records dropped\n", dropped);
+        }
+        fflush(_file);
+    }
+
+    std::chrono::steady_clock::time_point const _start;
+    FILE *_file;
+
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    bool _stop = false;
+    std::vector<std::unique_ptr<_Ring>> _rings;
+    std::vector<_Ring*> _freeRings;
+
+    std::mutex _flushMutex;
+    std::vector<_Record> _buffer;
+
+    std::thread _flusher;
+};
+
+void
+_Append(HdLuxCoreLogLevel level, const char *format, va_list args)
+{
+    _Sink &sink = _Sink::Get();
+
+    _Record record;
+    record.time = sink.GetTime();
+    record.thread = std::hash<std::thread::id>()(std::this_thread::get_id());
+    record.level = level;
+    vsnprintf(record.message, sizeof(record.message), format, args);
+
+    sink.GetRing()->Push(record);
+}
+
+} // anonymous namespace
+
+bool
+HdLuxCoreLogIsEnabled(HdLuxCoreLogLevel level)
+{
+    static int const runtimeLevel = TfGetEnvSetting(HDLUXCORE_LOG_LEVEL);
+    return level <= runtimeLevel;
+}
+
+void
+HdLuxCoreLog(HdLuxCoreLogLevel level, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    _Append(level, format, args);
+    va_end(args);
+}
+
+void
+HdLuxCoreLogLuxCoreMessage(const char *message)
+{
+    if (!HdLuxCoreLogIsEnabled(HdLuxCoreLogLevelInfo)) {
+        return;
+    }
+
+    // A one second window shared by all threads
+    static int const rate = TfGetEnvSetting(HDLUXCORE_LUXCORE_LOG_RATE);
+    static std::atomic<int64_t> window{-1};
+    static std::atomic<int> count{0};
+    static std::atomic<int> suppressed{0};
+
+    int64_t const second = std::chrono::duration_cast<std::chrono::seconds>(
+        _Sink::Get().GetTime()).count();
+    int64_t current = window.load();
+    if (second != current && window.compare_exchange_strong(current, second)) {
+        count.store(0);
+    }
+
+    if (count.fetch_add(1) >= rate) {
+        suppressed.fetch_add(1);
+        return;
+    }
+
+    int const skipped = suppressed.exchange(0);
+    if (skipped) {
+        HdLuxCoreLog(HdLuxCoreLogLevelInfo, "LuxCore: %s (%d messages skipped)",
+                     message, skipped);
+    } else {
+        HdLuxCoreLog(HdLuxCoreLogLevelInfo, "LuxCore: %s", message);
+    }
+}
+
+void
+HdLuxCoreLogFlush()
+{
+    _Sink::Get().Flush();
+}
+
+void
+HdLuxCoreStartTraceReport()
+{
+    if (!TfGetEnvSetting(HDLUXCORE_TRACE_REPORT).empty()) {
+        TraceCollector::GetInstance().SetEnabled(true);
+    }
+}
+
+void
+HdLuxCoreWriteTraceReport()
+{
+    std::string const path = TfGetEnvSetting(HDLUXCORE_TRACE_REPORT);
+    if (path.empty()) {
+        return;
+    }
+
+    std::ofstream file(path.c_str());
+    if (!file) {
+        HDLUXCORE_LOG(Error, "Cannot write the trace report to %s", path.c_str());
+        return;
+    }
+
+    TraceReporterPtr const reporter = TraceReporter::GetGlobalReporter();
+    if (TfStringEndsWith(path, ".json")) {
+        reporter->ReportChromeTracing(file);
+    } else {
+        reporter->UpdateTraceTrees();
+        reporter->Report(file);
+    }
+    HDLUXCORE_LOG(Info, "Wrote the trace report to %s", path.c_str());
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,82 @@
+#ifndef HDLUXCORE_TRACE_H
+#define HDLUXCORE_TRACE_H
+
+#include "pxr/pxr.h"
+#include "pxr/base/arch/attributes.h"
+#include "pxr/base/arch/functionLite.h"
+#include "pxr/base/trace/trace.h"
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+/// \enum HdLuxCoreLogLevel
+///
+/// Severity of an HdLuxCore log record. Records above
+/// HDLUXCORE_LOG_LEVEL_MAX are removed at compile time, records above the
+/// HDLUXCORE_LOG_LEVEL environment setting are skipped at run time.
+///
+enum HdLuxCoreLogLevel {
+    HdLuxCoreLogLevelError = 1,
+    HdLuxCoreLogLevelWarning = 2,
+    HdLuxCoreLogLevelInfo = 3,
+    HdLuxCoreLogLevelDebug = 4
+};
+
+// The most verbose level compiled in. Per-call function records are Debug
+// level, so they cost nothing unless the plugin is built with
+// -DHDLUXCORE_LOG_LEVEL_MAX=4.
+#ifndef HDLUXCORE_LOG_LEVEL_MAX
+#define HDLUXCORE_LOG_LEVEL_MAX 3
+#endif
+
+/// Return true if records of \p level are written at run time.
+bool HdLuxCoreLogIsEnabled(HdLuxCoreLogLevel level);
+
+/// Append a printf-style record to the calling thread's log ring buffer.
+/// Records are written to the log file, stderr by default, by a
+/// background thread; this never blocks on I/O or other threads. Records
+/// are dropped, and counted, if the thread's buffer is full.
+void HdLuxCoreLog(HdLuxCoreLogLevel level, const char *format, ...)
+    ARCH_PRINTF_FUNCTION(2, 3);
+
+/// Log a message from LuxCore's log handler. LuxCore can log thousands of
+/// lines per second while rendering, so these are rate limited; skipped
+/// messages are counted in the next record that gets through.
+void HdLuxCoreLogLuxCoreMessage(const char *message);
+
+/// Write out all buffered records. Called on exit, and usable before an
+/// expected crash or in tests.
+void HdLuxCoreLogFlush();
+
+/// Start collecting USD trace events for the report written by
+/// HdLuxCoreWriteTraceReport(), if the HDLUXCORE_TRACE_REPORT environment
+/// setting names a report file.
+void HdLuxCoreStartTraceReport();
+
+/// Write the trace report started by HdLuxCoreStartTraceReport(): the time
+/// spent in every traced scope and the trace counters, including the mesh,
+/// instancer and sampler kernels. A report file ending in ".json" is
+/// written in the Chrome tracing format instead.
+void HdLuxCoreWriteTraceReport();
+
+/// Log a record at the given level, e.g. HDLUXCORE_LOG(Info, "%d", n).
+#define HDLUXCORE_LOG(level, ...)                                           \
+    do {                                                                    \
+        if (HdLuxCoreLogLevel##level <= HDLUXCORE_LOG_LEVEL_MAX &&          \
+            HdLuxCoreLogIsEnabled(HdLuxCoreLogLevel##level)) {              \
+            HdLuxCoreLog(HdLuxCoreLogLevel##level, __VA_ARGS__);            \
+        }                                                                   \
+    } while (0)
+
+/// Log entry into the enclosing function, at Debug level.
+#define HDLUXCORE_LOG_FUNCTION()                                            \
+    HDLUXCORE_LOG(Debug, "%s", __ARCH_PRETTY_FUNCTION__)
+
+/// Time the enclosing function with the USD trace collector and log entry
+/// into it. Replaces per-call logging to stdout on Hydra callbacks.
+#define HDLUXCORE_TRACE_FUNCTION()                                          \
+    TRACE_FUNCTION();                                                       \
+    HDLUXCORE_LOG_FUNCTION()
+
+PXR_NAMESPACE_CLOSE_SCOPE
+
+#endif // HDLUXCORE_TRACE_H
@@ -0,0 +1,355 @@
+#!/usr/bin/env python
+"""Headless end-to-end benchmark of the LuxCore Hydra delegate.
+
+Generates a parameterized stage (N meshes of M triangles, K levels of
+nested point instancers with I instances each, L lights), renders it
+through UsdImagingGL with the LuxCore renderer and writes the timings as
+JSON, for regression tracking:
+
+  python script/benchmark.py --meshes 64 --triangles 20000 \\
+      --instancer-depth 2 --instances 100 --lights 4 --output result.json
+
+An existing stage can be benchmarked with --stage instead. Timings taken
+inside the plugin (sync, commit, scene edit, latencies) come from the
+render delegate's GetRenderStats().
+
+With --trace-report, the plugin also writes a USD trace report of its
+kernels (instance transforms, primvar sampling, boundary edge detection,
+OpenSubdiv refinement and stencil evaluation, vertex packing) when the
+renderer is released, for before and after numbers of optimizations.
+
+Rendering needs an OpenGL context; on a machine without a display, run
+under xvfb-run.
+"""
+
+from __future__ import print_function
+
+import argparse
+import json
+import math
+import os
+import platform
+import sys
+import time
+
+from pxr import CameraUtil, Gf, Usd, UsdGeom, UsdLux, UsdImagingGL, Vt
+
+RENDERER_PLUGIN = 'HdLuxCoreRendererPlugin'
+
+
+def _peak_rss_bytes():
+    """Return the peak resident set size of this process, or None."""
+    try:
+        import resource
+    except ImportError:
+        return None
+    peak = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    # Linux reports kilobytes, macOS bytes
+    return peak if platform.system() == 'Darwin' else peak * 1024
+
+
+def _grid_mesh(stage, path, triangles, size):
+    """Define a grid mesh of about the given number of triangles."""
+    quads = max(1, triangles // 2)
+    cols = max(1, int(math.sqrt(quads)))
+    rows = max(1, quads // cols)
+
+    points = []
+    for r in range(rows + 1):
+        for c in range(cols + 1):
+            x = size * (float(c) / cols - 0.5)
+            z = size * (float(r) / rows - 0.5)
+            y = 0.05 * size * math.sin(6.0 * x / size) * math.cos(6.0 * z / size)
+            points.append(Gf.Vec3f(x, y, z))
+
+    counts = []
+    indices = []
+    for r in range(rows):
+        for c in range(cols):
+            i = r * (cols + 1) + c
+            counts.append(4)
+            indices.extend([i, i + cols + 1, i + cols + 2, i + 1])
+
+    mesh = UsdGeom.Mesh.Define(stage, path)
+    mesh.CreatePointsAttr(Vt.Vec3fArray(points))
+    mesh.CreateFaceVertexCountsAttr(Vt.IntArray(counts))
+    mesh.CreateFaceVertexIndicesAttr(Vt.IntArray(indices))
+    mesh.CreateSubdivisionSchemeAttr(UsdGeom.Tokens.none)
+    mesh.CreateExtentAttr([Gf.Vec3f(-size / 2, -size, -size / 2),
+                           Gf.Vec3f(size / 2, size, size / 2)])
+    return mesh
+
+
+def _layout(index, count, spacing):
+    """Place item index of count on a square grid in the XZ plane."""
+    side = max(1, int(math.ceil(math.sqrt(count))))
+    return Gf.Vec3d(spacing * (index % side - (side - 1) / 2.0), 0.0,
+                    spacing * (index // side - (side - 1) / 2.0))
+
+
+def generate_scene(path, meshes, triangles, instancer_depth, instances, lights):
+    """Write a synthetic benchmark stage to path and return its extent."""
+    stage = Usd.Stage.CreateNew(path)
+    UsdGeom.SetStageUpAxis(stage, UsdGeom.Tokens.y)
+    world = UsdGeom.Xform.Define(stage, '/World')
+    stage.SetDefaultPrim(world.GetPrim())
+
+    size = 1.0
+    spacing = 1.5 * size
+
+    # Meshes
+    for i in range(meshes):
+        xform = UsdGeom.Xform.Define(stage, '/World/Meshes/mesh_%d' % i)
+        xform.AddTranslateOp().Set(_layout(i, meshes, spacing))
+        _grid_mesh(stage, xform.GetPath().AppendChild('geo'), triangles, size)
+    extent = spacing * math.ceil(math.sqrt(max(meshes, 1)))
+
+    # Nested point instancers: each level instances the level below it.
+    # Prototypes live under their instancer, so they're only drawn through it.
+    if instancer_depth > 0 and instances > 0:
+        root = UsdGeom.Xform.Define(stage, '/World/Instancers')
+        root.AddTranslateOp().Set(Gf.Vec3d(0.0, 2.0 * size, 0.0))
+
+        paths = [root.GetPath().AppendChild('level_%d' % instancer_depth)]
+        for level in range(instancer_depth - 1, -1, -1):
+            paths.append(paths[-1].AppendPath('Prototypes/level_%d' % level))
+        paths.reverse()
+
+        _grid_mesh(stage, paths[0], max(triangles // 10, 2), size)
+        level_size = spacing
+        for level in range(1, instancer_depth + 1):
+            instancer = UsdGeom.PointInstancer.Define(stage, paths[level])
+            instancer.CreatePrototypesRel().SetTargets([paths[level - 1]])
+            instancer.CreateProtoIndicesAttr(Vt.IntArray([0] * instances))
+            instancer.CreatePositionsAttr(Vt.Vec3fArray(
+                [Gf.Vec3f(_layout(i, instances, level_size)) for i in range(instances)]))
+            level_size *= math.ceil(math.sqrt(instances)) + 0.5
+        extent = max(extent, level_size)
+
+    # Lights, in a ring above the scene
+    for i in range(lights):
+        light = UsdLux.SphereLight.Define(stage, '/World/Lights/light_%d' % i)
+        angle = 2.0 * math.pi * i / max(lights, 1)
+        light.AddTranslateOp().Set(Gf.Vec3d(0.5 * extent * math.cos(angle),
+                                            0.5 * extent,
+                                            0.5 * extent * math.sin(angle)))
+        light.CreateRadiusAttr(0.05 * extent)
+        light.CreateIntensityAttr(50.0)
+
+    # A camera looking down at the whole scene
+    camera = UsdGeom.Camera.Define(stage, '/World/camera')
+    camera.AddTranslateOp().Set(Gf.Vec3d(0.0, 0.8 * extent, 1.2 * extent))
+    camera.AddRotateXOp().Set(-33.0)
+    camera.CreateClippingRangeAttr(Gf.Vec2f(0.01, 100.0 * extent))
+
+    stage.GetRootLayer().Save()
+    return extent
+
+
+def _find_camera(stage):
+    for prim in stage.Traverse():
+        if prim.IsA(UsdGeom.Camera):
+            return UsdGeom.Camera(prim)
+    return None
+
+
+def _frame_stage(stage, aspect):
+    """Return a frustum looking at the whole stage."""
+    bounds = UsdGeom.BBoxCache(Usd.TimeCode.Default(),
+                               [UsdGeom.Tokens.default_]).ComputeWorldBound(
+        stage.GetPseudoRoot()).ComputeAlignedRange()
+    center = bounds.GetMidpoint()
+    radius = max(bounds.GetSize().GetLength() / 2.0, 1.0)
+
+    frustum = Gf.Frustum()
+    frustum.SetPerspective(45.0, aspect, 0.01 * radius, 100.0 * radius)
+    frustum.SetPosition(center + Gf.Vec3d(0.0, 0.5 * radius, 2.5 * radius))
+    frustum.SetRotation(Gf.Rotation(Gf.Vec3d(1, 0, 0), -11.0))
+    return frustum
+
+
+class RenderHarness(object):
+    """Renders a stage with the LuxCore delegate in an offscreen GL context."""
+
+    def __init__(self, stage, width, height, settings=None):
+        self._gl = self._create_gl_context(width, height)
+
+        self.stage = stage
+        self.width = width
+        self.height = height
+
+        self.engine = UsdImagingGL.Engine()
+        if not self.engine.SetRendererPlugin(RENDERER_PLUGIN):
+            raise RuntimeError('Renderer plugin %s is not available' % RENDERER_PLUGIN)
+        if not hasattr(self.engine, 'GetRenderStats'):
+            raise RuntimeError('These USD Python bindings have no '
+                               'UsdImagingGL.Engine.GetRenderStats(), which is '
+                               'needed to read the renderer\'s progress')
+        for key, value in (settings or {}).items():
+            self.set_setting(key, value)
+
+        camera = _find_camera(stage)
+        aspect = float(width) / height
+        if camera:
+            frustum = camera.GetCamera(Usd.TimeCode.Default()).frustum
+            frustum.window = CameraUtil.ConformedWindow(
+                frustum.window, CameraUtil.Fit, aspect)
+        else:
+            frustum = _frame_stage(stage, aspect)
+        self.engine.SetCameraState(frustum.ComputeViewMatrix(),
+                                   frustum.ComputeProjectionMatrix())
+        self.engine.SetRenderViewport(Gf.Vec4d(0, 0, width, height))
+
+        self.params = UsdImagingGL.RenderParams()
+        self.params.complexity = 1.0
+        self.params.enableLighting = True
+
+    @staticmethod
+    def _create_gl_context(width, height):
+        try:
+            from PySide2 import QtOpenGL, QtWidgets
+        except ImportError:
+            from PySide import QtOpenGL
+            from PySide import QtGui as QtWidgets
+        app = QtWidgets.QApplication.instance() or QtWidgets.QApplication([])
+        widget = QtOpenGL.QGLWidget()
+        widget.resize(width, height)
+        widget.makeCurrent()
+        return app, widget
+
+    def render(self):
+        from OpenGL import GL
+        GL.glViewport(0, 0, self.width, self.height)
+        GL.glClear(GL.GL_COLOR_BUFFER_BIT | GL.GL_DEPTH_BUFFER_BIT)
+        self.engine.Render(self.stage.GetPseudoRoot(), self.params)
+
+    def close(self):
+        """Release the renderer, which writes the plugin's trace report."""
+        self.engine = None
+
+    def set_setting(self, key, value):
+        """Set a render setting of the delegate."""
+        self.engine.SetRendererSetting(key, value)
+
+    def stats(self):
+        """Return the render delegate's statistics."""
+        return dict(self.engine.GetRenderStats())
+
+    def render_until(self, predicate, timeout):
+        """Render frames until predicate(stats) holds or timeout seconds
+        passed. Return the elapsed time, or None on timeout."""
+        start = time.time()
+        while time.time() - start < timeout:
+            self.render()
+            if predicate(self.stats()):
+                return time.time() - start
+            time.sleep(0.005)
+        return None
+
+
+def run_benchmark(args):
+    result = {
+        'host': platform.node(),
+        'platform': platform.platform(),
+        'parameters': vars(args).copy(),
+    }
+
+    if args.stage:
+        stage_path = args.stage
+    else:
+        stage_path = args.generated_stage
+        start = time.time()
+        generate_scene(stage_path, args.meshes, args.triangles,
+                       args.instancer_depth, args.instances, args.lights)
+        result['generateSeconds'] = time.time() - start
+
+    start = time.time()
+    stage = Usd.Stage.Open(stage_path)
+    result['openSeconds'] = time.time() - start
+
+    settings = {}
+    if args.threads:
+        settings['renderThreadCount'] = args.threads
+    harness = RenderHarness(stage, args.width, args.height, settings)
+
+    # The first frame populates the render index, syncs and commits
+    start = time.time()
+    harness.render()
+    result['firstFrameSeconds'] = time.time() - start
+
+    # Time to first pixel: until the film has samples of the scene
+    first_pixel = harness.render_until(
+        lambda stats: stats.get('samplesPerPixel', 0.0) > 0.0, args.timeout)
+    result['firstPixelSeconds'] = (
+        None if first_pixel is None else result['firstFrameSeconds'] + first_pixel)
+
+    # Steady state: samples per second over the measured interval
+    stats = harness.stats()
+    samples_start = stats.get('samplesPerPixel', 0.0)
+    start = time.time()
+    while time.time() - start < args.duration:
+        harness.render()
+        time.sleep(0.05)
+    stats = harness.stats()
+    elapsed = time.time() - start
+    result['steadySamplesPerPixelPerSecond'] = (
+        (stats.get('samplesPerPixel', 0.0) - samples_start) / elapsed)
+    result['steadySamplesPerSecond'] = stats.get('samplesPerSecond')
+    result['steadyRaysPerSecond'] = stats.get('raysPerSecond')
+    result['peakRssBytes'] = _peak_rss_bytes()
+
+    # The plugin's own phase timings, latencies, counts and memory use
+    result['renderStats'] = dict((key, value) for key, value in stats.items()
+                                 if isinstance(value, (bool, int, float, str)))
+
+    harness.close()
+    if args.trace_report:
+        result['traceReport'] = args.trace_report
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--stage', help='benchmark this stage instead of a generated one')
+    parser.add_argument('--generated-stage', default='benchmark_scene.usda',
+                        help='where to write the generated stage')
+    parser.add_argument('--meshes', type=int, default=16)
+    parser.add_argument('--triangles', type=int, default=10000,
+                        help='triangles per mesh')
+    parser.add_argument('--instancer-depth', type=int, default=1,
+                        help='levels of nested point instancers')
+    parser.add_argument('--instances', type=int, default=64,
+                        help='instances per instancer level')
+    parser.add_argument('--lights', type=int, default=2)
+    parser.add_argument('--width', type=int, default=640)
+    parser.add_argument('--height', type=int, default=480)
+    parser.add_argument('--threads', type=int, default=0,
+                        help='render threads, 0 for automatic')
+    parser.add_argument('--duration', type=float, default=10.0,
+                        help='seconds of steady state rendering to measure')
+    parser.add_argument('--timeout', type=float, default=300.0,
+                        help='seconds to wait for the first pixel')
+    parser.add_argument('--output', help='write the JSON result here instead of stdout')
+    parser.add_argument('--trace-report',
+                        help='write a trace report of the plugin kernels here; '
+                             'Chrome tracing format if it ends in .json')
+    args = parser.parse_args()
+
+    # Read by the plugin when it's loaded
+    if args.trace_report:
+        os.environ['HDLUXCORE_TRACE_REPORT'] = os.path.abspath(args.trace_report)
+
+    result = run_benchmark(args)
+    text = json.dumps(result, indent=2, sort_keys=True)
+    if args.output:
+        with open(args.output, 'w') as f:
+            f.write(text + '\n')
+    else:
+        print(text)
+    return 0 if result['firstPixelSeconds'] is not None else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1 @@
+python script/benchmark.py --meshes 64 --triangles 20000 --instancer-depth 2 --instances 100 --lights 4 --output benchmark_result.json
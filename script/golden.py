@@ -0,0 +1,349 @@
+#!/usr/bin/env python
+"""Golden image and performance regression suite of the LuxCore Hydra
+delegate.
+
+Renders the assets in test/asset and generated stress scenes in the
+delegate's deterministic mode (fixed seed, sample count and thread count),
+then compares every image to its golden EXR and the time to converge and
+peak memory to the recorded baseline:
+
+  python script/golden.py             # compare, exit 1 on any failure
+  python script/golden.py --update    # record new goldens and baseline
+
+After convergence, each scene also changes the tonemapper and checks that
+the film kept its samples, since image pipeline edits must never reset it.
+
+Edit cases render an asset with a persistent cache enabled, move a prim once
+it converged and render again. The edited image must differ from the first
+and match a render of the edited stage from scratch, so a cache built before
+the edit is never reused.
+
+Each scene renders in its own process, so peak memory is per scene.
+Goldens and baselines depend on the machine and the LuxCore build, so none
+are committed; record them on the machine that runs the suite. A scene
+without a golden image or baseline skips that comparison and is reported as
+SKIPPED, without failing the suite. Image comparison needs the OpenImageIO
+Python module.
+"""
+
+from __future__ import print_function
+
+import argparse
+import glob
+import json
+import os
+import shutil
+import subprocess
+import sys
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+REPO_DIR = os.path.dirname(SCRIPT_DIR)
+
+# Generated stress scenes, as benchmark.generate_scene() arguments
+STRESS_SCENES = {
+    'stress_meshes': dict(meshes=64, triangles=20000, instancer_depth=0,
+                          instances=0, lights=2),
+    'stress_instances': dict(meshes=1, triangles=2000, instancer_depth=2,
+                             instances=100, lights=2),
+    'stress_lights': dict(meshes=4, triangles=2000, instancer_depth=0,
+                          instances=0, lights=32),
+}
+
+# Edit cases: the asset in test/asset, render settings, and the prim moved
+# once the render converged with its offset
+EDIT_CASES = {
+    'edit_dls_cache_light': (
+        'geo_GridSphereLightCam.004.usd_scene.usda',
+        {'lightStrategy': 'DLS_CACHE'},
+        '/lights/light1', (-3.0, 0.0, 0.0)),
+    'edit_photongi_object': (
+        'geo_GridSphereLightCam.004.usd_scene.usda',
+        {'enablePhotonGI': True},
+        '/sphere1', (2.0, 0.0, 0.0)),
+}
+
+
+def _move_prim(stage, path, offset):
+    """Translate the prim at path by offset, in its parent's space."""
+    from pxr import Gf, UsdGeom
+
+    xformable = UsdGeom.Xformable(stage.GetPrimAtPath(path))
+    transform = xformable.GetLocalTransformation()
+    xformable.ClearXformOpOrder()
+    xformable.AddTransformOp().Set(
+        transform * Gf.Matrix4d().SetTranslate(Gf.Vec3d(*offset)))
+
+
+def render_one(args):
+    """Render one stage to an image, in this process, and write the timings."""
+    sys.path.insert(0, SCRIPT_DIR)
+    import benchmark
+    from pxr import Usd
+
+    settings = {
+        'enableDeterministic': True,
+        'deterministicSeed': args.seed,
+        'deterministicSamples': args.samples,
+        'renderThreadCount': args.threads,
+        'filmOutputFile': os.path.abspath(args.image),
+    }
+    settings.update(json.loads(args.settings))
+    if os.path.exists(args.image):
+        os.remove(args.image)
+
+    stage = Usd.Stage.Open(args.render_one)
+    harness = benchmark.RenderHarness(stage, args.width, args.height, settings)
+
+    converged = harness.render_until(
+        lambda stats: harness.engine.IsConverged(), args.timeout)
+    result = {
+        'timeToConvergedSeconds': converged,
+        'peakRssBytes': benchmark._peak_rss_bytes(),
+    }
+
+    # Keep the converged image, move the prim and render the edited scene
+    # until it converges and is written again
+    if args.edit_prim and converged is not None:
+        shutil.copyfile(args.image, args.image_before)
+        os.remove(args.image)
+        _move_prim(stage, args.edit_prim, json.loads(args.edit_offset))
+        stage.Export(args.edited_stage)
+        harness.render()
+        result['timeToEditConvergedSeconds'] = harness.render_until(
+            lambda stats: harness.engine.IsConverged() and os.path.exists(args.image),
+            args.timeout)
+        converged = result['timeToEditConvergedSeconds']
+
+    # Image pipeline settings only post-process the film, so editing them
+    # must keep the samples rendered so far
+    samples = harness.stats().get('samplesPerPixel', 0.0)
+    harness.set_setting('tonemapper', 'REINHARD02')
+    for _ in range(5):
+        harness.render()
+    result['samplesBeforePipelineEdit'] = samples
+    result['samplesAfterPipelineEdit'] = harness.stats().get('samplesPerPixel', 0.0)
+    harness.close()
+
+    with open(args.json, 'w') as f:
+        json.dump(result, f, indent=2, sort_keys=True)
+    return 0 if converged is not None and os.path.exists(args.image) else 1
+
+
+def _scenes(work_dir):
+    """Return the name and stage path of every scene of the suite."""
+    sys.path.insert(0, SCRIPT_DIR)
+    import benchmark
+
+    scenes = []
+    for path in sorted(glob.glob(os.path.join(REPO_DIR, 'test', 'asset', '*.usda'))):
+        scenes.append((os.path.basename(path).split('.')[0], path))
+    for name in sorted(STRESS_SCENES):
+        path = os.path.join(work_dir, name + '.usda')
+        benchmark.generate_scene(path, **STRESS_SCENES[name])
+        scenes.append((name, path))
+    return scenes
+
+
+def _compare_images(image, golden, args):
+    """Return None if image matches golden within tolerance, else the reason."""
+    import OpenImageIO as oiio
+
+    a = oiio.ImageBuf(image)
+    b = oiio.ImageBuf(golden)
+    if a.spec().width != b.spec().width or a.spec().height != b.spec().height:
+        return 'size %dx%d, golden %dx%d' % (a.spec().width, a.spec().height,
+                                              b.spec().width, b.spec().height)
+
+    comparison = oiio.ImageBufAlgo.compare(a, b, args.max_error, args.mean_error)
+    if comparison.meanerror > args.mean_error or comparison.maxerror > args.max_error:
+        return 'mean error %g, max error %g' % (comparison.meanerror,
+                                                comparison.maxerror)
+    return None
+
+
+def _render(args, stage, image, timings, settings=None, edit=None):
+    """Render stage in a new process, writing image and timings. edit is
+    the (prim path, offset, before image, edited stage) of an edit case.
+    Return True on success."""
+    command = [sys.executable, os.path.abspath(__file__),
+               '--render-one', stage, '--image', image, '--json', timings,
+               '--settings', json.dumps(settings or {}),
+               '--samples', str(args.samples), '--seed', str(args.seed),
+               '--threads', str(args.threads), '--width', str(args.width),
+               '--height', str(args.height), '--timeout', str(args.timeout)]
+    if edit:
+        prim, offset, image_before, edited_stage = edit
+        command += ['--edit-prim', prim, '--edit-offset', json.dumps(offset),
+                    '--image-before', image_before,
+                    '--edited-stage', edited_stage]
+    return subprocess.call(command) == 0
+
+
+def _cache_settings(settings, cache_dir):
+    """Return settings with an empty persistent cache directory."""
+    if os.path.isdir(cache_dir):
+        shutil.rmtree(cache_dir)
+    os.makedirs(cache_dir)
+    result = dict(settings)
+    result['persistentCacheDirectory'] = cache_dir
+    return result
+
+
+def run_edit_case(name, args, work_dir):
+    """Run edit case name. Return a list of failures."""
+    asset, settings, prim, offset = EDIT_CASES[name]
+    stage = os.path.join(REPO_DIR, 'test', 'asset', asset)
+    before = os.path.join(work_dir, name + '_before.exr')
+    after = os.path.join(work_dir, name + '.exr')
+    edited_stage = os.path.join(work_dir, name + '_edited.usda')
+    if not _render(args, stage, after, os.path.join(work_dir, name + '.json'),
+                   _cache_settings(settings, os.path.join(work_dir, name + '_cache')),
+                   (prim, offset, before, edited_stage)):
+        return ['%s: rendering failed' % name]
+
+    # The edited stage from scratch, with a cache of its own
+    reference = os.path.join(work_dir, name + '_reference.exr')
+    if not _render(args, edited_stage, reference,
+                   os.path.join(work_dir, name + '_reference.json'),
+                   _cache_settings(settings, os.path.join(work_dir, name + '_reference_cache'))):
+        return ['%s: rendering the edited stage failed' % name]
+
+    failures = []
+    if _compare_images(after, before, args) is None:
+        failures.append('%s: moving %s didn\'t change the image' % (name, prim))
+    reason = _compare_images(after, reference, args)
+    if reason:
+        failures.append('%s: image differs from a render of the edited stage '
+                        'from scratch (%s)' % (name, reason))
+    print('%s: %s' % (name, 'FAILED' if failures else 'ok'))
+    return failures
+
+
+def run_suite(args):
+    golden_dir = os.path.abspath(args.golden_dir)
+    work_dir = os.path.abspath(args.output_dir)
+    for directory in (golden_dir, work_dir):
+        if not os.path.isdir(directory):
+            os.makedirs(directory)
+
+    baseline_path = os.path.join(golden_dir, 'baseline.json')
+    baseline = {}
+    if os.path.exists(baseline_path):
+        with open(baseline_path) as f:
+            baseline = json.load(f)
+
+    failures = []
+    skipped = []
+    results = {}
+    for name, stage in _scenes(work_dir):
+        image = os.path.join(work_dir, name + '.exr')
+        timings = os.path.join(work_dir, name + '.json')
+        if not _render(args, stage, image, timings):
+            failures.append('%s: rendering failed' % name)
+            continue
+
+        with open(timings) as f:
+            result = json.load(f)
+        results[name] = result
+        print('%s: converged in %.2fs, peak memory %.1f MB' % (
+            name, result['timeToConvergedSeconds'],
+            (result['peakRssBytes'] or 0) / 1048576.0))
+
+        if (result['samplesBeforePipelineEdit'] <= 0.0 or
+                result['samplesAfterPipelineEdit'] < result['samplesBeforePipelineEdit']):
+            failures.append('%s: image pipeline edit cleared the film '
+                            '(%g samples per pixel before, %g after)' % (
+                                name, result['samplesBeforePipelineEdit'],
+                                result['samplesAfterPipelineEdit']))
+
+        golden = os.path.join(golden_dir, name + '.exr')
+        if args.update:
+            if os.path.exists(golden):
+                os.remove(golden)
+            os.rename(image, golden)
+            continue
+
+        if not os.path.exists(golden):
+            skipped.append('%s: no golden image in %s, record one with --update' % (
+                name, golden_dir))
+        else:
+            reason = _compare_images(image, golden, args)
+            if reason:
+                failures.append('%s: image differs from golden (%s)' % (name, reason))
+
+        # Performance regressions against the baseline
+        reference = baseline.get(name)
+        if not reference:
+            skipped.append('%s: no baseline in %s, record one with --update' % (
+                name, baseline_path))
+            continue
+        limit = reference['timeToConvergedSeconds'] * (1.0 + args.time_threshold)
+        if result['timeToConvergedSeconds'] > limit:
+            failures.append('%s: converged in %.2fs, baseline %.2fs' % (
+                name, result['timeToConvergedSeconds'],
+                reference['timeToConvergedSeconds']))
+        if result['peakRssBytes'] and reference.get('peakRssBytes'):
+            limit = reference['peakRssBytes'] * (1.0 + args.memory_threshold)
+            if result['peakRssBytes'] > limit:
+                failures.append('%s: peak memory %d bytes, baseline %d bytes' % (
+                    name, result['peakRssBytes'], reference['peakRssBytes']))
+
+    if not args.update:
+        for name in sorted(EDIT_CASES):
+            failures += run_edit_case(name, args, work_dir)
+
+    if args.update:
+        with open(baseline_path, 'w') as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+        print('Recorded goldens and baseline in %s' % golden_dir)
+
+    for skip in skipped:
+        print('SKIPPED %s' % skip)
+    for failure in failures:
+        print('FAILED %s' % failure)
+    return 1 if failures else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--update', action='store_true',
+                        help='record new golden images and baseline')
+    parser.add_argument('--golden-dir', default=os.path.join(REPO_DIR, 'test', 'golden'))
+    parser.add_argument('--output-dir', default='golden_output',
+                        help='where rendered images and stress scenes are written')
+    parser.add_argument('--samples', type=int, default=64, help='samples per pixel')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--threads', type=int, default=4)
+    parser.add_argument('--width', type=int, default=320)
+    parser.add_argument('--height', type=int, default=240)
+    parser.add_argument('--timeout', type=float, default=600.0,
+                        help='seconds to wait for a scene to converge')
+    parser.add_argument('--mean-error', type=float, default=1e-3,
+                        help='largest mean per channel difference from the golden')
+    parser.add_argument('--max-error', type=float, default=0.05,
+                        help='largest per channel difference from the golden')
+    parser.add_argument('--time-threshold', type=float, default=0.2,
+                        help='largest time to converge increase over the baseline')
+    parser.add_argument('--memory-threshold', type=float, default=0.1,
+                        help='largest peak memory increase over the baseline')
+
+    # Used by the suite to render each scene in its own process
+    parser.add_argument('--render-one', help=argparse.SUPPRESS)
+    parser.add_argument('--image', help=argparse.SUPPRESS)
+    parser.add_argument('--json', help=argparse.SUPPRESS)
+    parser.add_argument('--settings', default='{}', help=argparse.SUPPRESS)
+    parser.add_argument('--edit-prim', help=argparse.SUPPRESS)
+    parser.add_argument('--edit-offset', help=argparse.SUPPRESS)
+    parser.add_argument('--image-before', help=argparse.SUPPRESS)
+    parser.add_argument('--edited-stage', help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if args.render_one:
+        return render_one(args)
+    return run_suite(args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1 @@
+python script/golden.py